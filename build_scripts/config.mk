@@ -17,8 +17,12 @@ export TARGET_LD = $(TARGET)-gcc
 export TARGET_LINKFLAGS =
 export TARGET_LIBS =
 
+# Lowest stage2 log level compiled in: TRACE, DEBUG, INFO, WARNING, ERROR or NONE
+export LOG_LEVEL ?= INFO
+
 export BUILD_DIR = $(abspath build)
 export ROOT_DIR = $(abspath root)
+export INITRD_DIR = $(abspath initrd)
 
 BINUTILS_VERSION = 2.42
 BINUTILS_URL = https://ftp.gnu.org/gnu/binutils/binutils-$(BINUTILS_VERSION).tar.xz
@@ -17,7 +17,7 @@ bits 16
 ;   - It must end with 0xAA55
 ;   - So as to also work for hard disks, preceding the AA55 must be 64 bytes for the partition table
 ;   - Preceding the partition table should be 6 bytes
-;   - We claim the byte before that as a fixed location into which the build process stores
+;   - We claim the word before that as a fixed location into which the build process stores
 ;       the size in sectors of stage2.bin
 ;
 ; There are a few ways to set up and use the MBR.
@@ -37,7 +37,7 @@ bits 16
 ;
 ; Assumptions:
 ;   The build process will store the size in sectors of stage2.bin in
-;     stage2_sector_size which will always be at 0x1b7
+;     stage2_sector_size which will always be the little endian word at 0x1b6
 ;   If the build process uses the MBR values set here then it must update
 ;     bpb_reserved_sectors with the size in sectors of stage2.bin + 1(for the MBR)
 ;     I guess I could use a single location for stage 2 size, but that would tie stage1 to having a BPB
@@ -120,24 +120,34 @@ start:
 ;
 ; Establish environment
 ;
-    ; Set data segment registers to zero
-    mov ax, 0           ; Can't set ds/es directly
+    ; Set data segment register to zero
+    xor ax, ax          ; Can't set ds/es directly
     mov ds, ax
+
+    cld                 ; clear direction flag so lodsb moves forward
+
+    ; Move ourselves out of the way so stage2 can be loaded over 0x7C00 when it grows past ~29KB
+    ; Keeping the same offsets in a different segment means no address in this file changes
+    mov si, 0x7C00
+    mov di, si
+    mov ax, RELOCATED_SEGMENT
     mov es, ax
-    
+    mov cx, 256
+    rep movsw           ; Copy CX words from DS:SI to ES:DI
+
+    mov ds, ax
+
     ; Setup stack
-    mov ss, ax          ; Set stack segment register to zero
+    mov ss, ax          ; Stack in the relocated segment
     mov sp, 0x7C00      ; Place stack below code which starts at 0x7C00. Stack goes down
 
-    cld                 ; clear direction flag so lodsb moves forward
-
-    ; Some BIOSs might start us at 0x7C00:0x0000
-    ; We want to ensure CS is 0x0000
-    ; Since we can't just set CS to zero as we might jump somewhere crazy, use a trick
+    ; Continue at the same offset in the relocated copy
+    ; This also ensures CS is what we expect as some BIOSs might start us at 0x7C00:0x0000
+    ; Since we can't just set CS directly, use a trick
     push es
-    push word .zero_cs
+    push word .relocated
     retf                ; A far return will load both CS and IP from the stack
-.zero_cs:
+.relocated:
 
     mov si, hello_msg
     call puts
@@ -164,11 +174,59 @@ start:
 ;
 ; Load stage 2
 ;
+; Use the int 13h extensions if the BIOS has them. They take an LBA directly
+; and can read up to 127 sectors per call rather than stopping at the end of a track
+;
+    mov ah, 41h                     ; Int 13h AH=41h: Check extensions present
+    mov bx, 0x55AA
+    mov dl, [ebr_drive_number]
+    stc
+    int 13h
+    jc .load_chs
+    cmp bx, 0xAA55
+    jne .load_chs
+    test cl, 1                      ; Bit 0: Device access using the packet structure
+    jz .load_chs
+
+    mov cx, [stage2_sector_size]    ; Sectors left to read
+
+.load_lba:
+    mov ax, cx
+    cmp ax, LBA_MAX_SECTORS
+    jbe .count_ok
+    mov ax, LBA_MAX_SECTORS
+.count_ok:
+    mov [dap_count], ax
+
+    ; Int 13h AH=42h: Extended read
+    ; Parameters:
+    ;   DL = drive
+    ;   DS:SI = Disk Address Packet
+    mov si, dap
+    mov ah, 42h
+    mov dl, [ebr_drive_number]
+    stc
+    int 13h
+    jc .load_chs                    ; Start again from the beginning using CHS
+
+    ; Advance the LBA and the destination segment past the sectors just read
+    mov ax, [dap_count]
+    sub cx, ax
+    add [dap_lba], ax
+    shl ax, 5                       ; 512 byte sectors are 32 paragraphs each
+    add [dap_segment], ax
+    test cx, cx
+    jnz .load_lba
+    jmp .loaded
+
+;
+; Fall back to CHS. This reads in a single call so stage2 must be no more than 128 sectors here
 ;   - ax: LBA
 ;   - cl: number of sectors to read (up to 128)
 ;   - dl: drive number
 ;   - es:bx: address of buffer to hold data read from disk
-
+;
+.load_chs:
     mov ax, 1                       ; Start reading from sector 1
     mov cl, [stage2_sector_size]    ; The size is set during the install process
     mov bx, STAGE2_LOAD_SEGMENT     ; Load into memory at STAGE2_LOAD_SEGMENT:STAGE2_LOAD_OFFSET
@@ -177,6 +235,7 @@ start:
     mov dl, [ebr_drive_number]      ; drive number
     call read_disk
 
+.loaded:
     ; Copy the partition table to somewhere safe
     mov si, partition_table
     mov ax, PARTITION_ENTRY_SEGMENT
@@ -394,15 +453,28 @@ halt:
 .halt:
     jmp .halt           ; Just in case CPU breaks out of hlt
 
+; Disk Address Packet for Int 13h AH=42h
+dap:            db 16, 0            ; Size of packet, reserved
+dap_count:      dw 0                ; Number of sectors to read
+dap_offset:     dw 0                ; Destination offset
+dap_segment:    dw STAGE2_LOAD_SEGMENT + (STAGE2_LOAD_OFFSET >> 4)  ; Offset zero lets each call read 127 sectors
+dap_lba:        dq 1                ; Stage2 starts at sector 1
+
 ; Strings
 
-disk_failure_msg: db 'Disk operation failed!', ENDL, 0
+disk_failure_msg: db 'Disk error!', ENDL, 0
 hello_msg: db 'Hello', ENDL, 0
 
 ; Load the stage2 into memory starting at 0x0500
 STAGE2_LOAD_SEGMENT equ 0x0
 STAGE2_LOAD_OFFSET  equ 0x500
 
+; Move stage1 to 0x70000 + 0x7C00, out of the way of stage2
+RELOCATED_SEGMENT   equ 0x7000
+
+; Int 13h AH=42h. Some BIOSs cannot read more than 127 sectors per call
+LBA_MAX_SECTORS     equ 127
+
 ; Copy the partition table to 0x20000
 PARTITION_ENTRY_SEGMENT equ 0x2000
 PARTITION_ENTRY_OFFSET  equ 0x0
@@ -410,9 +482,8 @@ PARTITION_ENTRY_OFFSET  equ 0x0
 times 512 -2 -4 -2 -64 -2 -($-$$) db 0
 
 ; These data structures go at the end of the boot sector so the previous line adds just teh right amount of padding
-pad: db 0
 global stage2_sector_size
-stage2_sector_size: db 0            ; Size of stage 2 in sectors (non-standard)
+stage2_sector_size: dw 0            ; Size of stage 2 in sectors (non-standard)
 UDID: dd 0x12345678                 ; Unique Disk ID
 Reserved: dw 0                      ; Reserved
 partition_table: times 64 db 0      ; Partition table. 4 entries each 16 bytes long
@@ -1,9 +1,10 @@
 #include "alloc.h"
 #include "stdtypes.h"
 #include "stdio.h"
+#include "log.h"
 #include "utility.h"
 
-#define MAX_HEAP_NODES 50
+#define MAX_HEAP_NODES 128     // Every open handle with a buffer uses one
 
 typedef enum {
     USED,
@@ -27,7 +28,7 @@ Uint32    bytesFree = 0;
 Bool heapInit(void* base, Uint32 size)
 {
     if (size < sizeof(heap)) {
-        printf("Space given to heap is too small: %d\n", size);
+        LOG_ERROR("Space given to heap is too small: %d\n", size);
         return false;
     }
 
@@ -63,7 +64,7 @@ void* alloc(Uint32 size)
     }
 
     if (hp == NULL) {
-        printf("alloc: Out of memory. Requested %d bytes. freeBytes = %d\n", size, bytesFree);
+        LOG_ERROR("alloc: Out of memory. Requested %d bytes. freeBytes = %d\n", size, bytesFree);
         panic("HEAP");
         return NULL;    // Never gets here
     }
@@ -90,7 +91,7 @@ void* alloc(Uint32 size)
     }
 
     if (np == NULL) {
-        printf("alloc: out of heap nodes\n");
+        LOG_ERROR("alloc: out of heap nodes\n");
         panic("HEAP");
         return NULL;    // Never gets here
     }
@@ -120,7 +121,7 @@ void free(void* chunk)
     }
 
     if (hp == NULL) {
-        printf("free: Attempted to free space not in the heap: %#x\n", chunk);
+        LOG_ERROR("free: Attempted to free space not in the heap: %#x\n", chunk);
         panic("HEAP");
         return;    // Never gets here
     }
@@ -58,6 +58,9 @@ section _TEXT
     mov ax, 0x10            ; 10h refers to third GDT entry which is a 32 bit protected mode data segment
     mov ds, ax
     mov ss, ax
+    mov es, ax              ; es too: a real mode pop es leaves a base of selector * 16 behind, which breaks rep movs/stos
+    mov fs, ax
+    mov gs, ax
 %endmacro
 
 ;
@@ -3,7 +3,20 @@
 #include "bios.h"
 #include "mbr.h"
 #include "stdio.h"
+#include "log.h"
 #include "utility.h"
+#include "alloc.h"
+#include "string.h"
+
+#define NO_TRACK        0xFFFFFFFF
+#define DMA_BOUNDARY    0x10000     // ISA DMA transfers cannot cross a 64KB physical boundary
+
+/*
+ * Forward declarations
+ */
+
+Bool disk_readTrack(Disk* disk, Uint32 track);
+Bool disk_readSectors(Disk* disk, Uint16 cylinder, Uint16 head, Uint16 sector, Uint8 count, Uint8* buffer);
 
 /*
  * Initialize the Disk object for the specified drive number from BIOS details
@@ -19,15 +32,15 @@ Bool diskInit(Disk* disk, Uint8 driveNumber, Partition* part)
     Uint16 numCylinders, numHeads, numSectors, bytesPerSectors;
 
     disk->hasExtensions = bios_hasDiskExtensions(driveNumber);
-    printf("hasExtensions = %d\n", disk->hasExtensions);
+    LOG_DEBUG("hasExtensions = %d\n", disk->hasExtensions);
 
     if (!bios_getDriveParams(driveNumber, &numCylinders, &numHeads, &numSectors)) {
-        printf("diskInit: Cannot get drive params\n");
+        LOG_ERROR("diskInit: Cannot get drive params\n");
         return false;
     }
 
     if (!disk->hasExtensions || !bios_getExtDriveParams(driveNumber, &bytesPerSectors)) {
-        printf("diskInit: Cannot get drive extended params. Guessing at bytes per sector\n");
+        LOG_WARNING("diskInit: Cannot get drive extended params. Guessing at bytes per sector\n");
         bytesPerSectors = 512;  // Default value
     }
 
@@ -37,8 +50,10 @@ Bool diskInit(Disk* disk, Uint8 driveNumber, Partition* part)
     disk->numSectors = numSectors;
     disk->bytesPerSector = bytesPerSectors;
     disk->offset = part->lba;
+    disk->trackBuffer = NULL;
+    disk->cachedTrack = NO_TRACK;
 
-    printf("diskInit: Cylinders = %d, Heads = %d, Sectors = %d, offset = %d, bps = %d, ext? = %d\n",
+    LOG_DEBUG("diskInit: Cylinders = %d, Heads = %d, Sectors = %d, offset = %d, bps = %d, ext? = %d\n",
         disk->numCylinders,
         disk->numHeads,
         disk->numSectors,
@@ -52,43 +67,36 @@ Bool diskInit(Disk* disk, Uint8 driveNumber, Partition* part)
 /*
  * Read count sectors from disk starting at lba into buffer
  *
+ * Reads are served from a one track cache. On a miss the whole track is read in a single
+ * BIOS call, so a run of small reads costs one rotation per track rather than one per read
+ *
  * Warning: count must be < 255. LBA is limited by the CHS geometry
  */
 Bool diskRead(Disk* disk, Uint32 lba, Uint8 count, Uint8* buffer)
 {
-    Uint16 cylinder, head, sector;
-    Uint8 status;
-    Bool ok;
-
     lba += disk->offset;
 
-    sector = (lba % disk->numSectors) + 1;
-    cylinder = (lba / disk->numSectors) / disk->numHeads;
-    head = (lba / disk->numSectors) % disk->numHeads;
-
-    //printf("diskRead: lba = %u, cylinder = %u, head = %u, sector = %u, count = %u\n", lba, cylinder, head, sector, count);
-
-    // Ralf Brown recommends trying up to three times to read with a reset between attempts
-    // since the read may fail due the motor failing to spin up quickly enough
-    // Not an issue with qemu, but is a best practice
-
-    // On Bochs, a failed read will set *count to 0
-    // On Qemu, a failed read will leave *count unchanged
-    for (int retries = 0; retries < 3; retries++) {
-        ok = bios_readDisk(disk->id, cylinder, head, sector, count, buffer, &status);
-        //printf("OK = %x, Status = %x\n", ok, status);
+    while (count > 0) {
+        Uint32 track = lba / disk->numSectors;
+        Uint16 sector = lba % disk->numSectors;
 
-        if (ok) {
-            return true;
+        if (track != disk->cachedTrack && !disk_readTrack(disk, track)) {
+            return false;
         }
-        printf("Retrying disk read...\n");
 
-        if (!bios_resetDisk(disk->id)) {
-            printf("Reset disk %d failed \n", disk->id);
+        Uint16 run = disk->numSectors - sector;
+        if (run > count) {
+            run = count;
         }
+
+        memcpy(buffer, disk->trackBuffer + sector * disk->bytesPerSector, run * disk->bytesPerSector);
+
+        buffer += run * disk->bytesPerSector;
+        lba += run;
+        count -= run;
     }
 
-    return false;
+    return true;
 }
 
 /*
@@ -106,20 +114,94 @@ Bool diskExtRead(Disk* disk, Uint32 lba, Uint16 count, Uint8* buff)
     Uint8 status;
     Bool ok;
 
-    lba += disk->offset;
-
-    //printf("diskExtRead: lba = %#x, count = %#x sectors, buff= %#p\n", lba, count, buff);
+    LOG_TRACE("diskExtRead: lba = %#x, count = %#x sectors, buff= %#p\n", lba, count, buff);
 
     if (disk->hasExtensions) {
-        ok = bios_ExtReadDisk(disk->id, lba, count, buff, &status);
-        //printf("OK = %d, Status = %#x\n", ok, status);
-    } else if (count < 0x100 && lba < disk->numCylinders * disk->numHeads * disk->numSectors) {
-        ok = diskRead(disk, lba, count, buff);
+        ok = bios_ExtReadDisk(disk->id, lba + disk->offset, count, buff, &status);
+        LOG_TRACE("OK = %d, Status = %#x\n", ok, status);
+    } else if (count < 0x100 && lba + disk->offset + count <= disk->numCylinders * disk->numHeads * disk->numSectors) {
+        ok = diskRead(disk, lba, count, buff);    // diskRead applies the partition offset itself
     } else {
-        printf("Attempted read with invalid params for non-extended disk: lba = %#x, count = %#x sectors\n", lba, count);
+        LOG_ERROR("Attempted read with invalid params for non-extended disk: lba = %#x, count = %#x sectors\n", lba, count);
         panic("Cannot read disk");
         ok = false; // Should never get here
     }
 
     return ok;
-}
\ No newline at end of file
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * Fill the track cache with track (cylinder * numHeads + head)
+ *
+ * The buffer is sector aligned, so a 64KB DMA boundary can only fall between two sectors
+ * If it falls inside the buffer the track is read in two parts, one either side of it
+ */
+Bool disk_readTrack(Disk* disk, Uint32 track)
+{
+    Uint16 cylinder = track / disk->numHeads;
+    Uint16 head = track % disk->numHeads;
+
+    if (disk->trackBuffer == NULL) {
+        Uint32 trackBytes = disk->numSectors * disk->bytesPerSector;
+        Uint8* raw = alloc(trackBytes + disk->bytesPerSector);
+        if (raw == NULL) {
+            LOG_ERROR("diskRead: Cannot allocate %u byte track buffer\n", trackBytes);
+            return false;
+        }
+        disk->trackBuffer = (Uint8*) align((Uint32) raw, disk->bytesPerSector);
+    }
+
+    Uint32 toBoundary = DMA_BOUNDARY - ((Uint32) disk->trackBuffer % DMA_BOUNDARY);
+    Uint16 first = disk->numSectors;
+    if (toBoundary / disk->bytesPerSector < first) {
+        first = toBoundary / disk->bytesPerSector;
+    }
+
+    LOG_TRACE("disk_readTrack: track = %u, cylinder = %u, head = %u, first = %u\n", track, cylinder, head, first);
+
+    disk->cachedTrack = NO_TRACK;
+
+    if (!disk_readSectors(disk, cylinder, head, 1, first, disk->trackBuffer)) {
+        return false;
+    }
+
+    if (first < disk->numSectors
+     && !disk_readSectors(disk, cylinder, head, first + 1, disk->numSectors - first,
+            disk->trackBuffer + first * disk->bytesPerSector)) {
+        return false;
+    }
+
+    disk->cachedTrack = track;
+    return true;
+}
+
+/*
+ * Read count sectors of one track with bios_readDisk, retrying on failure
+ */
+Bool disk_readSectors(Disk* disk, Uint16 cylinder, Uint16 head, Uint16 sector, Uint8 count, Uint8* buffer)
+{
+    Uint8 status;
+
+    // Ralf Brown recommends trying up to three times to read with a reset between attempts
+    // since the read may fail due the motor failing to spin up quickly enough
+    // Not an issue with qemu, but is a best practice
+
+    // On Bochs, a failed read will set *count to 0
+    // On Qemu, a failed read will leave *count unchanged
+    for (int retries = 0; retries < 3; retries++) {
+        if (bios_readDisk(disk->id, cylinder, head, sector, count, buffer, &status)) {
+            return true;
+        }
+        LOG_WARNING("Retrying disk read... status = %#x\n", status);
+
+        if (!bios_resetDisk(disk->id)) {
+            LOG_ERROR("Reset disk %d failed \n", disk->id);
+        }
+    }
+
+    return false;
+}
@@ -11,6 +11,8 @@ typedef struct {
     Uint16  numSectors;
     Uint16  bytesPerSector;
     Uint32  offset;         // LBA offset to start of partition
+    Uint8*  trackBuffer;    // Whole track cache for CHS reads. Allocated on first use
+    Uint32  cachedTrack;    // Track held in trackBuffer: cylinder * numHeads + head
 } Disk;
 
 Bool diskInit(Disk* disk, Uint8 driveNumber, Partition* part);
@@ -0,0 +1,194 @@
+#include "elf.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "log.h"
+#include "memdefs.h"
+#include "string.h"
+#include "vfs.h"
+
+/*
+ * ELF32 executable loader
+ *
+ * https://refspecs.linuxfoundation.org/elf/elf.pdf
+ *
+ * The file starts with the ELF header which locates the program header table
+ * Each PT_LOAD program header describes a segment: p_filesz bytes at p_offset in the file
+ * to be placed at p_paddr, followed by p_memsz - p_filesz bytes of zeros (the .bss)
+ *
+ * We read each segment straight to its physical address and zero-fill the remainder,
+ * so the .bss costs nothing on disk and no time to read
+ *
+ * The bytes come from an ElfReader so the same loader works for a VFS file or a fw_cfg blob
+ * Both can read at any offset, so each segment is fetched directly with no skipping or re-reading
+ */
+
+#define ELF_MAX_PROGRAM_HEADERS     16
+
+enum {
+    ELF_CLASS_32            = 1,
+    ELF_DATA_LITTLE_ENDIAN  = 1,
+    ELF_TYPE_EXECUTABLE     = 2,
+    ELF_MACHINE_386         = 3,
+    ELF_PT_LOAD             = 1
+};
+
+typedef struct {
+    Uint8   magic[4];           // 0x7F 'E' 'L' 'F'
+    Uint8   fileClass;          // 1 = 32 bit
+    Uint8   dataEncoding;       // 1 = little endian
+    Uint8   identVersion;
+    Uint8   identPadding[9];
+    Uint16  type;               // 2 = executable
+    Uint16  machine;            // 3 = i386
+    Uint32  version;
+    Uint32  entry;              // Entry point address
+    Uint32  programHeaderOffset;
+    Uint32  sectionHeaderOffset;
+    Uint32  flags;
+    Uint16  headerSize;
+    Uint16  programHeaderSize;
+    Uint16  programHeaderCount;
+    Uint16  sectionHeaderSize;
+    Uint16  sectionHeaderCount;
+    Uint16  sectionNameIndex;
+} __attribute__((packed)) ElfHeader;
+
+typedef struct {
+    Uint32  type;
+    Uint32  offset;             // Offset of the segment in the file
+    Uint32  virtualAddress;
+    Uint32  physicalAddress;    // Where we place the segment
+    Uint32  fileSize;           // Bytes in the file
+    Uint32  memorySize;         // Bytes in memory. The excess over fileSize is zero-filled
+    Uint32  flags;
+    Uint32  alignment;
+} __attribute__((packed)) ProgramHeader;
+
+/*
+ * Forward declarations
+ */
+
+Bool elf_readFileAt(void* source, Uint32 offset, Uint32 count, void* buff);
+Bool elf_validateHeader(ElfHeader* header);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Load the ELF executable open on fin
+ */
+Bool elfLoadFile(Handle fin, void** entry, void** end)
+{
+    return elfLoad(elf_readFileAt, &fin, entry, end);
+}
+
+/*
+ * Load the ELF executable whose bytes are returned by read(source, ...)
+ *
+ * On success *entry is the entry point and *end is the first address past the highest segment
+ */
+Bool elfLoad(ElfReader read, void* source, void** entry, void** end)
+{
+    ElfHeader header;
+
+    if (!read(source, 0, sizeof(ElfHeader), &header)) {
+        LOG_ERROR("elfLoad: Failed to read ELF header\n");
+        return false;
+    }
+
+    if (!elf_validateHeader(&header)) {
+        return false;
+    }
+
+    ProgramHeader phs[ELF_MAX_PROGRAM_HEADERS];
+    Uint16 numPhs = header.programHeaderCount;
+
+    if (numPhs > ELF_MAX_PROGRAM_HEADERS) {
+        LOG_ERROR("elfLoad: Too many program headers: %u\n", numPhs);
+        return false;
+    }
+
+    if (!read(source, header.programHeaderOffset, numPhs * sizeof(ProgramHeader), phs)) {
+        LOG_ERROR("elfLoad: Failed to read program headers\n");
+        return false;
+    }
+
+    Uint32 highest = 0;
+
+    for (int ii = 0; ii < numPhs; ++ii) {
+        ProgramHeader* ph = &phs[ii];
+        if (ph->type != ELF_PT_LOAD || ph->memorySize == 0) {
+            continue;
+        }
+
+        if (ph->physicalAddress < (Uint32) KERNEL_LOAD_ADDR || ph->fileSize > ph->memorySize) {
+            LOG_ERROR("elfLoad: Invalid segment: paddr = %#x, filesz = %#x, memsz = %#x\n",
+                ph->physicalAddress, ph->fileSize, ph->memorySize);
+            return false;
+        }
+
+        Uint8* dst = (Uint8*) ph->physicalAddress;
+        LOG_INFO("elfLoad: segment offset = %#x -> %p, filesz = %#x, memsz = %#x\n",
+            ph->offset, dst, ph->fileSize, ph->memorySize);
+
+        if (ph->fileSize > 0 && !read(source, ph->offset, ph->fileSize, dst)) {
+            LOG_ERROR("elfLoad: Failed to read segment at offset %#x\n", ph->offset);
+            return false;
+        }
+
+        memset(dst + ph->fileSize, 0, ph->memorySize - ph->fileSize);
+
+        if (ph->physicalAddress + ph->memorySize > highest) {
+            highest = ph->physicalAddress + ph->memorySize;
+        }
+    }
+
+    if (highest == 0) {
+        LOG_ERROR("elfLoad: No loadable segments\n");
+        return false;
+    }
+
+    *entry = (void*) header.entry;
+    *end = (void*) highest;
+
+    return true;
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * ElfReader for a VFS file. source points to the Handle
+ */
+Bool elf_readFileAt(void* source, Uint32 offset, Uint32 count, void* buff)
+{
+    Handle fin = *(Handle*) source;
+
+    return vReadAt(fin, offset, count, buff) == count;
+}
+
+Bool elf_validateHeader(ElfHeader* header)
+{
+    if (header->magic[0] != 0x7F || header->magic[1] != 'E' || header->magic[2] != 'L' || header->magic[3] != 'F') {
+        LOG_ERROR("elfLoad: Not an ELF file\n");
+        return false;
+    }
+
+    if (header->fileClass != ELF_CLASS_32
+     || header->dataEncoding != ELF_DATA_LITTLE_ENDIAN
+     || header->type != ELF_TYPE_EXECUTABLE
+     || header->machine != ELF_MACHINE_386) {
+        LOG_ERROR("elfLoad: Not a 32 bit little endian i386 executable: class = %d, data = %d, type = %d, machine = %d\n",
+            header->fileClass, header->dataEncoding, header->type, header->machine);
+        return false;
+    }
+
+    if (header->programHeaderSize != sizeof(ProgramHeader)) {
+        LOG_ERROR("elfLoad: Unexpected program header size %d\n", header->programHeaderSize);
+        return false;
+    }
+
+    return true;
+}
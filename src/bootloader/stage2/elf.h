@@ -0,0 +1,12 @@
+#pragma once
+
+#include "stdtypes.h"
+#include "vfs.h"
+
+/*
+ * Read count bytes at offset within the executable into buff. Returns false on a short read
+ */
+typedef Bool (*ElfReader)(void* source, Uint32 offset, Uint32 count, void* buff);
+
+Bool elfLoad(ElfReader read, void* source, void** entry, void** end);
+Bool elfLoadFile(Handle fin, void** entry, void** end);
@@ -1,6 +1,7 @@
 #include "ext.h"
 #include "stdtypes.h"
 #include "stdio.h"
+#include "log.h"
 #include "memdefs.h"
 #include "mbr.h"
 #include "disk.h"
@@ -8,14 +9,24 @@
 #include "alloc.h"
 #include "string.h"
 
-#define MAX_HANDLES                 10
+#define INITIAL_HANDLES             4
+#define MAX_HANDLES                 127     // Handle is an Int8
 #define MAX_FILENAME_LENGTH         255
 #define NUM_DIRECT_BLOCKS_IN_INODE  12
+#define MAX_INDIRECTION             3       // Triply indirect
+#define MAX_CACHED_DEPTH            5       // Three levels of indirect blocks or up to five of extent tree nodes
+#define EXTENT_MAGIC                0xF30A
+#define EXTENT_MAX_INIT_LENGTH      32768   // Longer lengths mark an uninitialized extent which reads as zeros
+#define GROUP_DESC_SIZE             32      // Without the 64bit feature
+#define DIRECTORY_ENTRY_HEADER_SIZE 8       // DirectoryEntry up to the name
+#define BIOS_BUFFER_LIMIT           0x100000    // BIOS disk reads can only target memory below 1MB
+#define MAX_SECTORS_PER_READ        127         // Some BIOSs cannot read more in one call
+#define BOUNCE_BUFFER_SIZE          0x8000      // Low memory staging area for reads destined above 1MB
 #define SUPERBLOCK_DISK_ADDRESS     1024    // The superblock is always at 1024 bytes into the partition
 #define SUPERBLOCK_LENGTH           1024    // and is always 1024 bytes long
 #define SUPERBLOCK_SIGNATURE        0xef53
-#define BGD_TABLE_SECTOR            2
 #define ROOT_DIR_INODE              2
+#define REV0_INODE_SIZE             128     // Revision 0 filesystems have no inodeSize in the superblock
 
 /*
  * EXT2 Filesystem data structures
@@ -66,8 +77,57 @@ typedef struct {
     Uint32      journalInode;
     Uint32      journalDevice;
     Uint32      headOrphanInodeList;
+
+    // Fields added by ext3 and ext4
+    Uint32      hashSeed[4];        // Seed for the directory index hashes
+    Uint8       defaultHashVersion;
+    Uint8       journalBackupType;
+    Uint16      descSize;           // Size of a group descriptor if the 64bit feature is set
+    Uint32      defaultMountOptions;
+    Uint32      firstMetaBlockGroup;
+    Uint32      mkfsTime;
+    Uint32      journalBlocks[17];
+    Uint32      numBlocksHigh;
+    Uint32      numBlocksReservedHigh;
+    Uint32      numUnallocatedBlocksHigh;
+    Uint16      minExtraInodeSize;
+    Uint16      wantExtraInodeSize;
+    Uint32      flags;
 } __attribute__((packed)) Superblock;
 
+/*
+ * Incompatible features (Superblock.requiredFeatures) that change how files are found and read
+ */
+enum IncompatFeatures {
+    INCOMPAT_COMPRESSION    = 0x00001,
+    INCOMPAT_FILETYPE       = 0x00002,
+    INCOMPAT_RECOVER        = 0x00004,
+    INCOMPAT_JOURNAL_DEV    = 0x00008,
+    INCOMPAT_META_BG        = 0x00010,
+    INCOMPAT_EXTENTS        = 0x00040,
+    INCOMPAT_64BIT          = 0x00080,
+    INCOMPAT_MMP            = 0x00100,
+    INCOMPAT_FLEX_BG        = 0x00200,
+    INCOMPAT_EA_INODE       = 0x00400,
+    INCOMPAT_DIRDATA        = 0x01000,
+    INCOMPAT_CSUM_SEED      = 0x02000,
+    INCOMPAT_LARGEDIR       = 0x04000,
+    INCOMPAT_INLINE_DATA    = 0x08000,
+    INCOMPAT_ENCRYPT        = 0x10000
+};
+
+enum CompatFeatures {
+    COMPAT_DIR_INDEX        = 0x0020    // Directories may have a hashed index
+};
+
+enum SuperblockFlags {
+    SB_FLAG_SIGNED_HASH     = 0x0001,
+    SB_FLAG_UNSIGNED_HASH   = 0x0002    // Directory hashes were made with unsigned char
+};
+
+#define INCOMPAT_UNSUPPORTED (INCOMPAT_COMPRESSION | INCOMPAT_JOURNAL_DEV | INCOMPAT_META_BG \
+                            | INCOMPAT_DIRDATA | INCOMPAT_INLINE_DATA | INCOMPAT_ENCRYPT)
+
 typedef struct {
     Uint32      baBlockBitmap;
     Uint32      baInodeBitmap;
@@ -75,6 +135,8 @@ typedef struct {
     Uint16      numUnallocatedBlocks;
     Uint16      numUnallocatedInodes;
     Uint16      numDirectories;
+    Uint16      padding;
+    Uint8       reserved[12];   // Pads the descriptor to 32 bytes. With 64bit the high halves follow
 } __attribute__((packed)) BlockGroupDescriptor;
 
 typedef struct {
@@ -101,6 +163,41 @@ typedef struct {
     Uint8       oss2[12];    
 } __attribute__((packed)) Inode;
 
+enum InodeFlags {
+    IN_FLAG_INDEX   = 0x01000,      // Directory has a hashed index
+    IN_FLAG_EXTENTS = 0x80000       // directBlocks onwards hold the root of an extent tree
+};
+
+/*
+ * ext4 extent tree
+ *
+ * Each node is a header followed by entries. In interior nodes (depth > 0) each entry is an
+ * ExtentIndex pointing at a child node. In leaves each entry is an Extent describing a run of
+ * contiguous blocks. The root node lives in the inode in place of the block pointers
+ */
+
+typedef struct {
+    Uint16      magic;              // EXTENT_MAGIC
+    Uint16      numEntries;
+    Uint16      maxEntries;
+    Uint16      depth;              // Zero for a leaf
+    Uint32      generation;
+} __attribute__((packed)) ExtentHeader;
+
+typedef struct {
+    Uint32      fileBlock;          // First file block covered by the child
+    Uint32      leafLow;            // Block holding the child node
+    Uint16      leafHigh;
+    Uint16      unused;
+} __attribute__((packed)) ExtentIndex;
+
+typedef struct {
+    Uint32      fileBlock;          // First file block in the extent
+    Uint16      length;             // Number of blocks
+    Uint16      startHigh;
+    Uint32      startLow;           // First disk block
+} __attribute__((packed)) Extent;
+
 enum InodeType {
     IN_TAP_FIFO     = 0x1000,
     IN_TAP_CDEV     = 0x2000,
@@ -133,6 +230,49 @@ typedef struct {
     Uint8       name[MAX_FILENAME_LENGTH];
 } __attribute__((packed)) DirectoryEntry;
 
+/*
+ * Hashed directory index (htree)
+ */
+
+#define DX_ROOT_INFO_OFFSET         24          // After the "." and ".." entries
+#define DX_NODE_ENTRIES_OFFSET      8           // After an empty entry spanning the block
+#define DX_MAX_LEVELS               3           // Index levels below the root, plus one
+#define DX_BLOCK_MASK               0x0FFFFFFF
+#define DX_HASH_EOF                 0x7FFFFFFF
+
+typedef struct {
+    Uint32      reservedZero;
+    Uint8       hashVersion;
+    Uint8       infoLength;
+    Uint8       indirectLevels;     // Index levels below the root
+    Uint8       unusedFlags;
+} __attribute__((packed)) DxRootInfo;
+
+typedef struct {
+    Uint16      limit;
+    Uint16      count;              // Number of entries including this one
+} __attribute__((packed)) DxCountLimit;
+
+typedef struct {
+    Uint32      hash;               // Lowest hash in block. Entry 0 holds a DxCountLimit here instead
+    Uint32      block;              // Block within the directory
+} __attribute__((packed)) DxEntry;
+
+enum DxHashVersion {
+    DX_HASH_LEGACY              = 0,
+    DX_HASH_HALF_MD4            = 1,
+    DX_HASH_TEA                 = 2,
+    DX_HASH_LEGACY_UNSIGNED     = 3,
+    DX_HASH_HALF_MD4_UNSIGNED   = 4,
+    DX_HASH_TEA_UNSIGNED        = 5
+};
+
+enum DxResult {
+    DX_NOT_INDEXED,
+    DX_NOT_FOUND,
+    DX_FOUND
+};
+
 enum DirectoryEntryType {
     DE_TYPE_UNKNOWN = 0,
     DE_TYPE_FILE    = 1,
@@ -149,21 +289,37 @@ enum DirectoryEntryType {
  */
 
 /*
- * There is one File per possible handle
- * They are stored in ext.files[handle]
+ * There is one File per handle
+ * They are stored in ext.files[handle], a table which grows when every handle is in use
  * Each File contains info needed for open and read functions
- *   including a pointer to a buffer on the heap which holds one block of data
+ *   including a pointer to a buffer on the heap which holds one block of data.
+ *   The buffer is allocated on the first read that needs it and freed on close
  */
 
 typedef struct {
     Uint8       id;                 // Handle
     Bool        isOpened;           // If false then available for use
     Inode       inode;              // Copy of inode
-    Uint32      position;           // Current position in bytes
+    Uint64      size;               // Size in bytes
+    Uint64      position;           // Current position in bytes
     Uint32      blockInBuffer;      // Number of block currently loaded into buffer
     void*       buffer;             // Point to current block buffer
+    Uint32      extentFileBlock;    // Last extent used: first file block
+    Uint32      extentLength;       //   number of blocks. Zero if none
+    Uint32      extentStart;        //   first disk block. Zero if uninitialized
 } File;
 
+/*
+ * One block of block pointers per level of indirection
+ *
+ * Sequential reads look up the same indirect blocks over and over, so the most recently read block
+ * at each depth is kept. Entries are keyed by block number so they can be shared by all files
+ */
+typedef struct {
+    Uint32      block;              // Block number held in pointers. Zero if none
+    Uint32*     pointers;
+} IndirectCache;
+
 /*
  * The ExtData structure all info required to read files from an EXT filesystem
  * including an array for files (open or available)
@@ -171,14 +327,27 @@ typedef struct {
 typedef struct {
     Disk        disk;
     Uint32      blockSize;  // in bytes
+    Uint8       logBlockSize;       // blockSize == 1 << logBlockSize
     Uint16      inodeSize;  // in bytes
     Uint16      sectorsPerBlock;
     Uint32      numInodes;
     Uint32      numBlocks;
     Uint32      numBlocksPerGroup;
     Uint32      numInodesPerGroup;
-    Uint32      inodeTableBlock;    // Assumes there is only one group
-    File        files[MAX_HANDLES];
+    Uint32      numGroups;
+    Uint16      descSize;           // Size of each entry in bgdTable
+    Uint32      incompatFeatures;
+    Bool        hasDirIndex;        // Directories flagged IN_FLAG_INDEX can be searched by hash
+    Bool        unsignedHash;
+    Uint32      hashSeed[4];
+    Uint8*      bgdTable;           // The whole BGD table, read once at initialization
+    IndirectCache indirect[MAX_CACHED_DEPTH];   // indirect[0] is the block named in the inode
+    Uint8*      bounceBuffer;                   // BOUNCE_BUFFER_SIZE bytes below 1MB
+    Uint32      inodeBlockNum;                  // Inode table block held in inodeBlock. Zero if none
+    Uint8*      inodeBlock;
+    Uint8*      walkBuffer;                     // Block buffer for the directories extOpen walks through
+    File*       files;                          // numFiles Files, indexed by handle
+    Uint32      numFiles;
 } ExtData;
 
 /*
@@ -192,12 +361,32 @@ ExtData ext;
  */
 
 Bool ext_readBlock(Disk* disk, Uint32 block, void* buffer);
-File* ext_openFile(Uint32 iNum);
+Bool ext_readBgdTable(Uint32 superblockBlock);
+BlockGroupDescriptor* ext_getGroup(Uint32 group);
+Bool ext_initFile(File* file, Uint32 iNum);
+Bool ext_readInode(Uint32 iNum, Inode* inode);
+Uint64 ext_getInodeSize(Inode* inode);
+Bool ext_fillDirEntry(DirectoryEntry* de, VDirEntry* entry);
 Handle ext_getFreeHandle();
-Bool ext_readNextDirectoryEntry(File* file, DirectoryEntry* entry);
+Bool ext_growFileTable();
 void ext_closeFile(File* file);
 Bool ext_findFileInDirectory(const char* name, File* dir, DirectoryEntry* foundEntry);
+int  ext_findFileInIndex(const char* name, Uint32 nameLength, File* dir, DirectoryEntry* foundEntry);
+int  ext_searchIndex(DxEntry* entries, Uint32 hash);
+Bool ext_findInDirectoryBlock(const char* name, Uint32 nameLength, File* dir, DirectoryEntry* foundEntry);
+Bool ext_readDirectoryBlock(File* dir, Uint32 blockInFile);
+Uint32 ext_dirHash(const char* name, Uint32 length, Uint8 version);
+Uint32 ext_legacyHash(const char* name, Uint32 length, Bool isUnsigned);
+void ext_nameToHashBuffer(const char* name, Int32 length, Uint32* buf, int num, Bool isUnsigned);
+void ext_halfMD4Transform(Uint32* buf, Uint32* in);
+void ext_teaTransform(Uint32* buf, Uint32* in);
 Bool ext_getCorrectBlock(File* file);
+Bool ext_mapBlock(File* file, Uint32 blockInFile, Uint32* blockNum, Uint32* runLength);
+Bool ext_mapExtent(File* file, Uint32 blockInFile, Uint32* blockNum, Uint32* runLength);
+int  ext_searchExtentNode(ExtentHeader* header, Uint32 blockInFile);
+Uint32* ext_readIndirectBlock(int depth, Uint32 block);
+Uint32 ext_readRun(File* file, Uint8* buff, Uint32 count);
+Uint32 ext_countRun(Uint32* pointers, Uint32 index, Uint32 limit);
 
 void ext_printDirectoryEntry(DirectoryEntry* entry);
 void ext_printFile(File* file);
@@ -210,19 +399,18 @@ void ext_printFile(File* file);
  * Initialize the filesystem including
  *  the disk
  *  the ExtData structure
+ *  the block group descriptor table
  *  storage for file buffers
- *
- * This code will panic if there is more than one block group because support for it is not implemented
  */
 Bool extInitialize(Uint8 driveNumber, Partition* part)
 {
     // Initialize disk
     if (!diskInit(&ext.disk, driveNumber, part)) {
-        printf("extInitialize: Failed to initialize disk %d\n", driveNumber);
+        LOG_ERROR("extInitialize: Failed to initialize disk %d\n", driveNumber);
         return false;
     }
 
-    printf("Drive = %#x, Cylinders = %d, Heads = %d, Sectors = %d, bps = %d, offset = %d (%#x)\n",
+    LOG_INFO("Drive = %#x, Cylinders = %d, Heads = %d, Sectors = %d, bps = %d, offset = %d (%#x)\n",
         ext.disk.id,
         ext.disk.numCylinders,
         ext.disk.numHeads,
@@ -237,7 +425,7 @@ Bool extInitialize(Uint8 driveNumber, Partition* part)
                     SUPERBLOCK_DISK_ADDRESS / ext.disk.bytesPerSector,
                     divAndRoundUp(SUPERBLOCK_LENGTH, ext.disk.bytesPerSector),
                     (Uint8*) sb)) {
-        printf("extInitialize: Failed to read superblock of disk %d\n", driveNumber);
+        LOG_ERROR("extInitialize: Failed to read superblock of disk %d\n", driveNumber);
         return false;
     }
 
@@ -246,55 +434,70 @@ Bool extInitialize(Uint8 driveNumber, Partition* part)
         return false;
     }
 
-    ext.blockSize = 1024 << sb->logBlockSize;
-    ext.inodeSize = sb->inodeSize;
+    ext.logBlockSize = 10 + sb->logBlockSize;
+    ext.blockSize = 1 << ext.logBlockSize;
+    ext.inodeSize = (sb->majorVersion >= 1) ? sb->inodeSize : REV0_INODE_SIZE;
     ext.numInodes = sb->numInodes;
     ext.numBlocks = sb->numBlocks;
     ext.numBlocksPerGroup = sb->numBlocksPerGroup;
     ext.numInodesPerGroup = sb->numInodesPerGroup;
+    ext.incompatFeatures = (sb->majorVersion >= 1) ? sb->requiredFeatures : 0;
+    ext.descSize = (ext.incompatFeatures & INCOMPAT_64BIT) ? sb->descSize : GROUP_DESC_SIZE;
+    ext.hasDirIndex = sb->majorVersion >= 1 && (sb->optionalFeatures & COMPAT_DIR_INDEX);
+    ext.unsignedHash = ext.hasDirIndex && (sb->flags & SB_FLAG_UNSIGNED_HASH);
+    for (int ii = 0; ii < 4; ++ii) {
+        ext.hashSeed[ii] = ext.hasDirIndex ? sb->hashSeed[ii] : 0;
+    }
+
+    if (ext.incompatFeatures & INCOMPAT_UNSUPPORTED) {
+        LOG_ERROR("extInitialize: Unsupported features %#x\n", ext.incompatFeatures & INCOMPAT_UNSUPPORTED);
+        free(sb);
+        return false;
+    }
+
+    if ((ext.incompatFeatures & INCOMPAT_64BIT) && sb->numBlocksHigh != 0) {
+        LOG_ERROR("extInitialize: More than 2^32 blocks not supported\n");
+        free(sb);
+        return false;
+    }
 
     ext.sectorsPerBlock = ext.blockSize / ext.disk.bytesPerSector;
 
-    printf("extInit: bs=%#x, is=%#x, #i=%d, #b=%d, bpg=%d, ipg=%d\n",
+    LOG_INFO("extInit: bs=%#x, is=%#x, #i=%d, #b=%d, bpg=%d, ipg=%d, incompat=%#x, ds=%d\n",
             ext.blockSize,
             ext.inodeSize,
             ext.numInodes,
             ext.numBlocks,
             ext.numBlocksPerGroup,
-            ext.numInodesPerGroup);
+            ext.numInodesPerGroup,
+            ext.incompatFeatures,
+            ext.descSize);
     
-    free(sb); sb = NULL;
+    Uint32 superblockBlock = sb->superblockBlock;
 
-    Uint32 numGroups = divAndRoundUp(ext.numBlocks, ext.numBlocksPerGroup);
+    free(sb); sb = NULL;
 
-    if (numGroups > 1) {
-        // This disk is bigger than any toy disks I should be working with!
-        // Couldn't be bothered storing a whole table of BGDs
-        printf("Support for ext2 partitions with multiple groups not implemented\n");
+    if (!ext_readBgdTable(superblockBlock)) {
+        LOG_ERROR("extInitialize: Failed to read Block Group Descriptors of disk %d\n", driveNumber);
         return false;
     }
 
-    // Get what we need from the Block Group Descriptor (BGD)
-    BlockGroupDescriptor* bgd = alloc(ext.blockSize);
-
-    // The BGD is in the next block after the SB.
-    // If the block size is 1024 (the minimum) then that would be block 2, otherwise (for 2K or higher) it is 1
-    Uint32 bgdBlockNum = ((SUPERBLOCK_DISK_ADDRESS + SUPERBLOCK_LENGTH < ext.blockSize) ? 1 : 2);
-    if (!ext_readBlock(&ext.disk, bgdBlockNum, bgd)) {
-        printf("extInitialize: Failed to read first sector of Block Group Descriptors of disk %d\n", driveNumber);
-        return false;
+    for (int ii = 0; ii < MAX_CACHED_DEPTH; ++ii) {
+        ext.indirect[ii].block = 0;
+        ext.indirect[ii].pointers = alloc(ext.blockSize);
     }
 
-    ext.inodeTableBlock = bgd->inodeTableBlock;     // Assuming single block group
-    printf("inode table block = %#x\n", ext.inodeTableBlock);
+    ext.bounceBuffer = alloc(BOUNCE_BUFFER_SIZE);
+    ext.inodeBlockNum = 0;
+    ext.inodeBlock = alloc(ext.blockSize);
 
-    free(bgd); bgd = NULL;
+    ext.walkBuffer = alloc(ext.blockSize);
 
-    // Set up File table
-    for (int ii = 0; ii < MAX_HANDLES; ++ii) {
-        ext.files[ii].id = ii;
-        ext.files[ii].isOpened = false;
-        ext.files[ii].buffer = alloc(ext.blockSize);
+    // Set up File table. It grows as handles are needed
+    ext.files = NULL;
+    ext.numFiles = 0;
+    if (!ext_growFileTable()) {
+        return false;
     }
 
     return true;
@@ -302,16 +505,21 @@ Bool extInitialize(Uint8 driveNumber, Partition* part)
 
 Handle extOpen(const char* path)
 {
-    printf("extOpen: '%s'", path);
+    LOG_DEBUG("extOpen: '%s'\n", path);
 
     if (path == NULL || path[0] == '\0') {
-        printf("Failed to open file with empty path\n");
+        LOG_ERROR("Failed to open file with empty path\n");
         return BAD_HANDLE;
     }
 
     const char* originalPath = path;
 
-    File* file = ext_openFile(ROOT_DIR_INODE);
+    // Directories along the way are walked in a local File so they don't take up handles
+    File walk;
+    walk.buffer = ext.walkBuffer;
+    if (!ext_initFile(&walk, ROOT_DIR_INODE)) {
+        return BAD_HANDLE;
+    }
 
     if (path[0] == '/') {
         path++; // Skip leading '/'
@@ -323,28 +531,26 @@ Handle extOpen(const char* path)
         char component[MAX_FILENAME_LENGTH + 1];
         path = getComponent(path, component, '/', MAX_FILENAME_LENGTH + 1);
         if (*path != '\0' && *path != '/') {
-            printf("Failed to open file '%s': Component '%s' is too long\n", originalPath, component);
-            ext_closeFile(file);
+            LOG_ERROR("Failed to open file '%s': Component '%s' is too long\n", originalPath, component);
             return BAD_HANDLE;
         }
-        //printf("Found component '%s'\n", component);
+        LOG_TRACE("Found component '%s'\n", component);
 
         // See if it matches any directory entry
         DirectoryEntry entry;
         entry.inodeNum = 0x9999;
-        if (!ext_findFileInDirectory(component, file, &entry)) {
-            printf("Failed to open file '%s': Could not find '%s'\n", originalPath, component);
-            ext_closeFile(file);
+        if (!ext_findFileInDirectory(component, &walk, &entry)) {
+            LOG_ERROR("Failed to open file '%s': Could not find '%s'\n", originalPath, component);
             return BAD_HANDLE;
         }
-        //printf("extOpen: ");
-        //ext_printDirectoryEntry(&entry);
-        //printf("DE: inode = %d, size = %d, name length = %d, type = %#x\n",
-        //       entry.inodeNum, entry.size, entry.nameLength, entry.type);
+        LOG_TRACE("extOpen: ");
+        LOG_DUMP(LOG_LEVEL_TRACE, ext_printDirectoryEntry(&entry));
 
         // Switch to the new entry
-        ext_closeFile(file);
-        file = ext_openFile(entry.inodeNum);
+        if (!ext_initFile(&walk, entry.inodeNum)) {
+            LOG_ERROR("Failed to open file '%s': Could not read inode of '%s'\n", originalPath, component);
+            return BAD_HANDLE;
+        }
 
         if (*path == '\0') {
             break;
@@ -352,15 +558,27 @@ Handle extOpen(const char* path)
 
         path++;     // skip '/'
 
-        if (!(file->inode.typeAndPermissions & IN_TAP_DIR)) {
-            printf("Failed to open file '%s': Component '%s' is not a directory\n", originalPath, component);
-            panic("XXX");
-            ext_closeFile(file);
+        if ((walk.inode.typeAndPermissions & 0xF000) != IN_TAP_DIR) {
+            LOG_ERROR("Failed to open file '%s': Component '%s' is not a directory\n", originalPath, component);
             return BAD_HANDLE;
         }
     }
 
-    ext_printFile(file);
+    // Only now that we have found it does the file take a handle
+    Handle handle = ext_getFreeHandle();
+    if (handle == BAD_HANDLE) {
+        return BAD_HANDLE;
+    }
+
+    File* file = &ext.files[handle];
+    memcpy(file, &walk, sizeof(File));
+    file->id = handle;
+    file->isOpened = true;
+    file->buffer = NULL;
+    file->blockInBuffer = UINT32_MAX;
+    file->position = 0;
+
+    LOG_DUMP(LOG_LEVEL_DEBUG, ext_printFile(file));
 
     return file->id;
 }
@@ -369,30 +587,43 @@ Uint32 extRead(Handle fin, Uint32 count, void* buff)
 {
     File* file = &ext.files[fin];
 
-    //printf("extRead: fin = %d, pos = %d (%#x), count = %d\n", fin, file->position, file->position, count);
+    LOG_TRACE("extRead: fin = %d, pos = %d (%#x), count = %d\n", fin, file->position, file->position, count);
 
-    Uint32 remaining = file->inode.sizeLow - file->position;
+    Uint64 remaining = file->size - file->position;
     if (remaining < count) {
         count = remaining;
     }
 
     if (count == 0) {
-        printf("EOF\n");
+        LOG_TRACE("EOF\n");
         return 0;
     }
 
     Uint32 bytesRead = 0;
 
     while (bytesRead < count) {
-        ext_getCorrectBlock(file);
-
         Uint32 bytesToRead = count - bytesRead;
-        Uint32 positionInBlock = file->position % ext.blockSize;
+        Uint32 positionInBlock = file->position & (ext.blockSize - 1);
+
+        // Whole blocks are read a contiguous run at a time without going through the block buffer
+        if (positionInBlock == 0 && bytesToRead >= ext.blockSize) {
+            Uint32 runBytes = ext_readRun(file, buff + bytesRead, bytesToRead);
+            if (runBytes > 0) {
+                bytesRead += runBytes;
+                file->position += runBytes;
+                continue;
+            }
+        }
+
+        if (!ext_getCorrectBlock(file)) {
+            break;
+        }
+
         if (bytesToRead > ext.blockSize - positionInBlock) {
             bytesToRead = ext.blockSize - positionInBlock;
         }
         
-        //printf("Copying %d bytes from %x to %x\n", bytesToRead, file->buffer + positionInBlock, buff + bytesRead);
+        LOG_TRACE("Copying %d bytes from %x to %x\n", bytesToRead, file->buffer + positionInBlock, buff + bytesRead);
         memcpy(buff + bytesRead, file->buffer + positionInBlock, bytesToRead);
 
         bytesRead += bytesToRead;
@@ -402,11 +633,95 @@ Uint32 extRead(Handle fin, Uint32 count, void* buff)
     return bytesRead;
 }
 
+/*
+ * Read count bytes from offset within the file open on fin into buff
+ *
+ * Blocks are mapped from the offset directly, so reads can come in any order
+ * The handle's own position is left where it was
+ */
+Uint32 extReadAt(Handle fin, Uint64 offset, Uint32 count, void* buff)
+{
+    File* file = &ext.files[fin];
+
+    if (offset >= file->size) {
+        return 0;
+    }
+
+    Uint64 position = file->position;
+    file->position = offset;
+
+    Uint32 bytesRead = extRead(fin, count, buff);
+
+    file->position = position;
+
+    return bytesRead;
+}
+
 void extClose(Handle handle)
 {
     ext_closeFile(&ext.files[handle]);
 }
 
+Uint64 extGetSize(Handle handle)
+{
+    return ext.files[handle].size;
+}
+
+/*
+ * Fill entries with up to maxEntries entries of the directory open on handle
+ *
+ * Each pass decodes every entry it can from the block in the directory's buffer before moving on,
+ * so a listing costs one block read per directory block plus the inode blocks for the sizes.
+ * Neighbouring entries usually have neighbouring inodes, which ext_readInode keeps cached
+ *
+ * Returns the number of entries filled. Zero at the end of the directory or on error
+ */
+Uint32 extReadDir(Handle handle, VDirEntry* entries, Uint32 maxEntries)
+{
+    File* dir = &ext.files[handle];
+
+    if ((dir->inode.typeAndPermissions & 0xF000) != IN_TAP_DIR) {
+        LOG_ERROR("extReadDir: Handle %d is not a directory\n", handle);
+        return 0;
+    }
+
+    Uint32 numEntries = 0;
+
+    while (numEntries < maxEntries && dir->position < dir->size) {
+        if (!ext_getCorrectBlock(dir)) {
+            break;
+        }
+
+        Uint32 offset = dir->position & (ext.blockSize - 1);
+
+        while (numEntries < maxEntries && offset + DIRECTORY_ENTRY_HEADER_SIZE <= ext.blockSize) {
+            DirectoryEntry* de = (DirectoryEntry*) ((Uint8*) dir->buffer + offset);
+            if (de->size < DIRECTORY_ENTRY_HEADER_SIZE || offset + de->size > ext.blockSize) {
+                LOG_ERROR("extReadDir: Corrupt entry at %llu\n", dir->position);
+                return numEntries;
+            }
+
+            // Unused entries, including the htree node headers and checksum tails, have inode zero
+            if (de->inodeNum != 0) {
+                if (!ext_fillDirEntry(de, &entries[numEntries])) {
+                    return numEntries;
+                }
+                ++numEntries;
+            }
+
+            offset += de->size;
+            dir->position += de->size;
+        }
+
+        // Entries always span to the end of the block, but don't trust a short tail
+        if (offset + DIRECTORY_ENTRY_HEADER_SIZE > ext.blockSize) {
+            dir->position += ext.blockSize - offset;
+        }
+    }
+
+    return numEntries;
+}
+
 // ###############################################
 //      Private functions
 // ###############################################
@@ -419,23 +734,68 @@ Bool ext_readBlock(Disk* disk, Uint32 block, void* buffer)
 
 }
 
+/*
+ * Read the whole Block Group Descriptor table into ext.bgdTable
+ *
+ * The table starts in the block after the superblock, i.e. block 2 for 1K blocks and block 1 otherwise
+ * It is kept resident so that locating any inode costs no more than reading its inode block
+ */
+Bool ext_readBgdTable(Uint32 superblockBlock)
+{
+    // Groups start at the superblock's block, so the blocks before it, if any, belong to none
+    ext.numGroups = divAndRoundUp(ext.numBlocks - superblockBlock, ext.numBlocksPerGroup);
+
+    Uint32 numTableBlocks = divAndRoundUp(ext.numGroups * ext.descSize, ext.blockSize);
+    ext.bgdTable = alloc(numTableBlocks * ext.blockSize);
+
+    Uint8* bp = ext.bgdTable;
+    for (Uint32 ii = 0; ii < numTableBlocks; ++ii) {
+        if (!ext_readBlock(&ext.disk, superblockBlock + 1 + ii, bp)) {
+            return false;
+        }
+        bp += ext.blockSize;
+    }
+
+    LOG_DEBUG("extInit: %d groups, group 0 inode table block = %#x\n", ext.numGroups, ext_getGroup(0)->inodeTableBlock);
+
+    return true;
+}
+
+/*
+ * Descriptors are 32 bytes, or descSize bytes with the 64bit feature. We only use the low halves
+ */
+BlockGroupDescriptor* ext_getGroup(Uint32 group)
+{
+    return (BlockGroupDescriptor*) (ext.bgdTable + group * ext.descSize);
+}
+
+/*
+ * Search dir for name. dir must be positioned at the start
+ *
+ * Indexed directories are searched by hash. Others, or any whose index we can't use, are scanned a block at a time
+ */
 Bool ext_findFileInDirectory(const char* name, File* dir, DirectoryEntry* foundEntry)
 {
-    printf("FFID: Looking for '%s'\n", name);
+    LOG_TRACE("FFID: Looking for '%s'\n", name);
     if (name == NULL || name[0] == '\0') {
         return false;
     }
 
-    DirectoryEntry entry;
-    while (ext_readNextDirectoryEntry(dir, &entry)) {
-        char buff[MAX_FILENAME_LENGTH + 1];
-        memcpy(buff, entry.name, entry.nameLength);
-        buff[entry.nameLength] = '\0';
-        printf("Comparing '%s' to '%s'\n", name, buff);
+    Uint32 nameLength = strlen(name);
+
+    if (ext.hasDirIndex && (dir->inode.flags & IN_FLAG_INDEX)) {
+        int result = ext_findFileInIndex(name, nameLength, dir, foundEntry);
+        if (result != DX_NOT_INDEXED) {
+            return result == DX_FOUND;
+        }
+    }
 
-        if (memcmp(name, entry.name, entry.nameLength) == 0) {
-            memcpy(foundEntry, &entry, sizeof(DirectoryEntry));
-            //*foundEntry = entry;  <- Doesn't work
+    Uint32 numBlocks = (dir->size + ext.blockSize - 1) >> ext.logBlockSize;
+    for (Uint32 block = 0; block < numBlocks; ++block) {
+        if (!ext_readDirectoryBlock(dir, block)) {
+            return false;
+        }
+        if (ext_findInDirectoryBlock(name, nameLength, dir, foundEntry)) {
             return true;
         }
     }
@@ -443,155 +803,788 @@ Bool ext_findFileInDirectory(const char* name, File* dir, DirectoryEntry* foundE
     return false;
 }
 
-File* ext_openFile(Uint32 iNum)
+/*
+ * Look up name in a directory with a hashed index (htree)
+ *
+ * Block 0 of an indexed directory is a dx_root: the "." and ".." entries followed by the index.
+ * Each index is a sorted array of (hash, block) pairs. Deeper levels are dx_nodes, which look
+ * like a single empty directory entry spanning the block followed by another such array.
+ * The pairs at the last level name the leaf blocks, which are ordinary directory blocks holding
+ * the entries whose hashes fall between that pair's hash and the next
+ *
+ * So a lookup reads the root, one block per further index level and then normally a single leaf
+ *
+ * Returns DX_NOT_INDEXED if the index can't be used, in which case the caller scans linearly
+ */
+int ext_findFileInIndex(const char* name, Uint32 nameLength, File* dir, DirectoryEntry* foundEntry)
 {
-    printf("ext_openFile: inode = %d (%#x)\n", iNum, iNum);
+    if (!ext_readDirectoryBlock(dir, 0)) {
+        return DX_NOT_INDEXED;
+    }
 
-    Handle handle = ext_getFreeHandle();
-    if (handle == BAD_HANDLE) {
-        return NULL;
+    DxRootInfo* info = (DxRootInfo*) ((Uint8*) dir->buffer + DX_ROOT_INFO_OFFSET);
+    if (info->reservedZero != 0 || info->hashVersion > DX_HASH_TEA || info->indirectLevels >= DX_MAX_LEVELS) {
+        LOG_ERROR("ext_findFileInIndex: Unsupported index: hash = %d, levels = %d\n", info->hashVersion, info->indirectLevels);
+        return DX_NOT_INDEXED;
     }
-    File* file = &ext.files[handle];
 
-    // Assuming there is only one block group
+    Uint8 hashVersion = info->hashVersion;
+    if (ext.unsignedHash) {
+        hashVersion += DX_HASH_LEGACY_UNSIGNED;     // The unsigned variants follow the signed ones
+    }
+    Uint32 hash = ext_dirHash(name, nameLength, hashVersion);
 
-    Uint32 iBlock = ext.inodeTableBlock + ((iNum - 1) * ext.inodeSize) / ext.blockSize;
-    Uint32 iOffset = ((iNum - 1) * ext.inodeSize) % ext.blockSize;
+    // Walk down the index. Remember where we were in the last index block for collisions
+    Uint32 levels = info->indirectLevels;
+    Uint32 indexBlock = 0;
+    Uint32 entriesOffset = DX_ROOT_INFO_OFFSET + info->infoLength;
+    int at;
 
-    //printf("Dir block = %#x, offset = %#x\n", iBlock, iOffset);
+    for (Uint32 level = 0; ; ++level) {
+        at = ext_searchIndex((DxEntry*) ((Uint8*) dir->buffer + entriesOffset), hash);
+        Uint32 block = ((DxEntry*) ((Uint8*) dir->buffer + entriesOffset))[at].block & DX_BLOCK_MASK;
 
-    Uint8* inodeBlock = alloc(ext.blockSize);
-    if (!ext_readBlock(&ext.disk, iBlock, inodeBlock)) {
-        printf("ext_openFile: Failed to read inode block %#x\n", iBlock);
-        return NULL;
+        if (level == levels) {
+            break;
+        }
+
+        if (!ext_readDirectoryBlock(dir, block)) {
+            return DX_NOT_FOUND;
+        }
+        indexBlock = block;
+        entriesOffset = DX_NODE_ENTRIES_OFFSET;
+    }
+
+    for (;;) {
+        DxEntry* entries = (DxEntry*) ((Uint8*) dir->buffer + entriesOffset);
+        Uint32 leafBlock = entries[at].block & DX_BLOCK_MASK;
+        Uint16 count = ((DxCountLimit*) entries)->count;
+
+        // If the next leaf starts with our hash (low bit set means the run continues) we may need it too
+        Bool mayContinue = (at + 1 < count) && (entries[at + 1].hash & ~1) == hash;
+
+        if (!ext_readDirectoryBlock(dir, leafBlock)) {
+            return DX_NOT_FOUND;
+        }
+
+        if (ext_findInDirectoryBlock(name, nameLength, dir, foundEntry)) {
+            return DX_FOUND;
+        }
+
+        if (!mayContinue) {
+            return DX_NOT_FOUND;
+        }
+
+        // Hash collision spilled into the next leaf. Reload the index block and move along one
+        // A run that crosses into the next index block is not followed
+        if (!ext_readDirectoryBlock(dir, indexBlock)) {
+            return DX_NOT_FOUND;
+        }
+        ++at;
+    }
+}
+
+/*
+ * Binary search an index for the last entry whose hash is <= hash
+ *
+ * Entry 0 has no hash. Its hash field holds the count and limit instead,
+ * and it covers everything below entry 1
+ */
+int ext_searchIndex(DxEntry* entries, Uint32 hash)
+{
+    int low = 1;
+    int high = ((DxCountLimit*) entries)->count - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (entries[mid].hash > hash) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return low - 1;
+}
+
+/*
+ * Search the directory block in dir->buffer for name
+ */
+Bool ext_findInDirectoryBlock(const char* name, Uint32 nameLength, File* dir, DirectoryEntry* foundEntry)
+{
+    Uint32 offset = 0;
+
+    while (offset + DIRECTORY_ENTRY_HEADER_SIZE <= ext.blockSize) {
+        DirectoryEntry* de = (DirectoryEntry*) ((Uint8*) dir->buffer + offset);
+        if (de->size < DIRECTORY_ENTRY_HEADER_SIZE) {
+            break;      // Corrupt. Don't loop forever
+        }
+
+        if (de->inodeNum != 0 && de->nameLength == nameLength && memcmp(name, de->name, nameLength) == 0) {
+            foundEntry->inodeNum = de->inodeNum;
+            foundEntry->size = de->size;
+            foundEntry->nameLength = de->nameLength;
+            foundEntry->type = de->type;
+            memcpy(&foundEntry->name, &de->name, de->nameLength);
+            return true;
+        }
+
+        offset += de->size;
+    }
+
+    return false;
+}
+
+/*
+ * Load block blockInFile of dir into dir->buffer
+ */
+Bool ext_readDirectoryBlock(File* dir, Uint32 blockInFile)
+{
+    dir->position = (Uint64) blockInFile << ext.logBlockSize;
+    if (dir->position >= dir->size) {
+        LOG_ERROR("ext_readDirectoryBlock: Block %d is beyond the end of the directory\n", blockInFile);
+        return false;
+    }
+
+    return ext_getCorrectBlock(dir);
+}
+
+/*
+ * Directory index hashes, as computed by Linux (fs/ext4/hash.c)
+ *
+ * The hashes differ depending on whether char was signed on the machine that created the
+ * filesystem. The superblock flags say which, and we fold that into the version
+ */
+Uint32 ext_dirHash(const char* name, Uint32 length, Uint8 version)
+{
+    Uint32 buf[4];
+    Uint32 in[8];
+    Uint32 hash = 0;
+    Bool isUnsigned = version >= DX_HASH_LEGACY_UNSIGNED;
+
+    // Default seed unless the superblock has one
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+
+    if (ext.hashSeed[0] | ext.hashSeed[1] | ext.hashSeed[2] | ext.hashSeed[3]) {
+        for (int ii = 0; ii < 4; ++ii) {
+            buf[ii] = ext.hashSeed[ii];
+        }
+    }
+
+    switch (version) {
+    case DX_HASH_LEGACY:
+    case DX_HASH_LEGACY_UNSIGNED:
+        hash = ext_legacyHash(name, length, isUnsigned);
+        break;
+
+    case DX_HASH_HALF_MD4:
+    case DX_HASH_HALF_MD4_UNSIGNED:
+        for (Int32 remaining = length; remaining > 0; remaining -= 32, name += 32) {
+            ext_nameToHashBuffer(name, remaining, in, 8, isUnsigned);
+            ext_halfMD4Transform(buf, in);
+        }
+        hash = buf[1];
+        break;
+
+    case DX_HASH_TEA:
+    case DX_HASH_TEA_UNSIGNED:
+        for (Int32 remaining = length; remaining > 0; remaining -= 16, name += 16) {
+            ext_nameToHashBuffer(name, remaining, in, 4, isUnsigned);
+            ext_teaTransform(buf, in);
+        }
+        hash = buf[0];
+        break;
+    }
+
+    // The low bit is reserved for marking collisions in the index, and the top value for EOF
+    hash &= ~1;
+    if (hash == (DX_HASH_EOF << 1)) {
+        hash = (DX_HASH_EOF - 1) << 1;
+    }
+
+    return hash;
+}
+
+Uint32 ext_legacyHash(const char* name, Uint32 length, Bool isUnsigned)
+{
+    Uint32 hash0 = 0x12a3fe2d;
+    Uint32 hash1 = 0x37abe8f9;
+
+    for (Uint32 ii = 0; ii < length; ++ii) {
+        int c = isUnsigned ? (int) (Uint8) name[ii] : (int) (Int8) name[ii];
+        Uint32 hash = hash1 + (hash0 ^ (c * 7152373));
+
+        if (hash & 0x80000000) {
+            hash -= 0x7fffffff;
+        }
+        hash1 = hash0;
+        hash0 = hash;
+    }
+
+    return hash0 << 1;
+}
+
+/*
+ * Pack up to num * 4 bytes of name into num words, padding with a value derived from the length
+ */
+void ext_nameToHashBuffer(const char* name, Int32 length, Uint32* buf, int num, Bool isUnsigned)
+{
+    Uint32 pad = (Uint32) length | ((Uint32) length << 8);
+    pad |= pad << 16;
+
+    Uint32 val = pad;
+    if (length > num * 4) {
+        length = num * 4;
+    }
+
+    for (int ii = 0; ii < length; ++ii) {
+        int c = isUnsigned ? (int) (Uint8) name[ii] : (int) (Int8) name[ii];
+        val = c + (val << 8);
+        if ((ii % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+
+    if (--num >= 0) {
+        *buf++ = val;
+    }
+    while (--num >= 0) {
+        *buf++ = pad;
+    }
+}
+
+#define ROTATE_LEFT(x, s)   (((x) << (s)) | ((x) >> (32 - (s))))
+#define MD4_F(x, y, z)      ((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z)      (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z)      ((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s)  (a += f(b, c, d) + (x), a = ROTATE_LEFT(a, s))
+#define MD4_K2              013240474631
+#define MD4_K3              015666365641
+
+/*
+ * The MD4 compression function cut down to three rounds of eight steps
+ */
+void ext_halfMD4Transform(Uint32* buf, Uint32* in)
+{
+    Uint32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    MD4_ROUND(MD4_F, a, b, c, d, in[0],  3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[1],  7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[2], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[3], 19);
+    MD4_ROUND(MD4_F, a, b, c, d, in[4],  3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[5],  7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[6], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[7], 19);
+
+    MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2,  3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2,  5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2,  9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+    MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2,  3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2,  5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2,  9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+
+    MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3,  3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3,  9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+    MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3,  3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3,  9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/*
+ * Sixteen rounds of the Tiny Encryption Algorithm
+ */
+void ext_teaTransform(Uint32* buf, Uint32* in)
+{
+    const Uint32 DELTA = 0x9E3779B9;
+    Uint32 sum = 0;
+    Uint32 b0 = buf[0], b1 = buf[1];
+    Uint32 a = in[0], b = in[1], c = in[2], d = in[3];
+
+    for (int n = 16; n > 0; --n) {
+        sum += DELTA;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+
+/*
+ * Point file at inode iNum, positioned at the start. The buffer is left alone
+ */
+Bool ext_initFile(File* file, Uint32 iNum)
+{
+    LOG_DEBUG("ext_initFile: inode = %d (%#x)\n", iNum, iNum);
+
+    if (!ext_readInode(iNum, &file->inode)) {
+        return false;
     }
-    //printf("inodeBlock = %#x\n", inodeBlock);
-    Inode* inode = (Inode*) (inodeBlock + iOffset);
-    //printf("size = %d, block0 = %#x\n", inode->sizeLow, inode->directBlocks[0]);
 
-    file->isOpened = true;
-    //file->inode = *inode;     <- doesn't work!?!?
-    memcpy(&file->inode, inode, sizeof(Inode));
     file->blockInBuffer = UINT32_MAX; // This will force a block load on first read attempt
     file->position = 0;
+    file->extentLength = 0;
+
+    file->size = ext_getInodeSize(&file->inode);
+
+    return true;
+}
+
+/*
+ * Copy inode iNum into *inode
+ *
+ * The inode table block last read is kept, so looking up a run of neighbouring inodes,
+ * as listing a directory does, costs one read per block of inodes rather than one per inode
+ */
+Bool ext_readInode(Uint32 iNum, Inode* inode)
+{
+    // Inodes are numbered from 1. Each group has its own inode table
+    Uint32 group = (iNum - 1) / ext.numInodesPerGroup;
+    Uint32 index = (iNum - 1) % ext.numInodesPerGroup;
+
+    if (iNum == 0 || group >= ext.numGroups) {
+        LOG_ERROR("ext_readInode: Invalid inode %d\n", iNum);
+        return false;
+    }
+
+    Uint32 iBlock = ext_getGroup(group)->inodeTableBlock + (index * ext.inodeSize) / ext.blockSize;
+    Uint32 iOffset = (index * ext.inodeSize) % ext.blockSize;
+
+    LOG_TRACE("Group = %d, inode block = %#x, offset = %#x\n", group, iBlock, iOffset);
+
+    if (iBlock != ext.inodeBlockNum) {
+        if (!ext_readBlock(&ext.disk, iBlock, ext.inodeBlock)) {
+            LOG_ERROR("ext_readInode: Failed to read inode block %#x\n", iBlock);
+            ext.inodeBlockNum = 0;
+            return false;
+        }
+        ext.inodeBlockNum = iBlock;
+    }
+
+    //*inode = *(Inode*) (ext.inodeBlock + iOffset);     <- doesn't work!?!?
+    memcpy(inode, ext.inodeBlock + iOffset, sizeof(Inode));
+
+    return true;
+}
+
+/*
+ * For regular files the high half of the size is in sizeHighOrDirACL. For directories it is an ACL
+ */
+Uint64 ext_getInodeSize(Inode* inode)
+{
+    Uint64 size = inode->sizeLow;
+    if ((inode->typeAndPermissions & 0xF000) == IN_TAP_FILE) {
+        size |= (Uint64) inode->sizeHighOrDirACL << 32;
+    }
 
-    return file;
+    return size;
+}
+
+/*
+ * Fill entry from the on-disk directory entry de
+ *
+ * The type comes from the inode, which we read anyway for the size, so it doesn't
+ * matter whether the filesystem records file types in its directory entries
+ */
+Bool ext_fillDirEntry(DirectoryEntry* de, VDirEntry* entry)
+{
+    Inode inode;
+    if (!ext_readInode(de->inodeNum, &inode)) {
+        return false;
+    }
+
+    entry->id = de->inodeNum;
+    entry->size = ext_getInodeSize(&inode);
+    entry->nameLength = de->nameLength;
+    memcpy(entry->name, de->name, de->nameLength);
+    entry->name[de->nameLength] = '\0';
+
+    switch (inode.typeAndPermissions & 0xF000) {
+        case IN_TAP_FILE:       entry->type = VDIR_TYPE_FILE; break;
+        case IN_TAP_DIR:        entry->type = VDIR_TYPE_DIR; break;
+        case IN_TAP_SYMLINK:    entry->type = VDIR_TYPE_SYMLINK; break;
+        case IN_TAP_FIFO:
+        case IN_TAP_CDEV:
+        case IN_TAP_BDEV:
+        case IN_TAP_SOCKET:     entry->type = VDIR_TYPE_OTHER; break;
+        default:                entry->type = VDIR_TYPE_UNKNOWN; break;
+    }
+
+    return true;
 }
 
 Handle ext_getFreeHandle()
 {
     Handle handle;
-    for (handle = 0; handle < MAX_HANDLES; ++handle) {
+    for (handle = 0; handle < ext.numFiles; ++handle) {
         if(!ext.files[handle].isOpened) {
             break;
         }
     }
 
-    if (handle == MAX_HANDLES) {
-        printf("Ran out of file handles\n");
+    if (handle == ext.numFiles && !ext_growFileTable()) {
         return BAD_HANDLE;
     }
 
     return handle;
 }
 
-Bool ext_readNextDirectoryEntry(File* file, DirectoryEntry* entry)
+/*
+ * Double the File table, up to MAX_HANDLES
+ *
+ * The table moves, so no File* may be held across a call that can take a new handle
+ */
+Bool ext_growFileTable()
 {
-    //printf("readNDE: pos = %#x, cbif = %#x, size = %d\n", file->position, file->blockInBuffer, file->inode.sizeLow);
+    Uint32 numFiles = (ext.numFiles == 0) ? INITIAL_HANDLES : ext.numFiles * 2;
+    if (numFiles > MAX_HANDLES) {
+        numFiles = MAX_HANDLES;
+    }
 
-    if (file->position >= file->inode.sizeLow) {
-        printf("EOF\n");
+    if (numFiles <= ext.numFiles) {
+        LOG_ERROR("Ran out of file handles\n");
         return false;
     }
 
-    ext_getCorrectBlock(file);
-
-    DirectoryEntry* de = (DirectoryEntry*) (file->buffer + file->position);
-    entry->inodeNum = de->inodeNum;
-    entry->size = de->size;
-    entry->nameLength = de->nameLength;
-    entry->type = de->type;
-    memcpy(&entry->name, &de->name, de->nameLength);
+    File* files = alloc(numFiles * sizeof(File));
+    if (ext.files != NULL) {
+        memcpy(files, ext.files, ext.numFiles * sizeof(File));
+        free(ext.files);
+    }
 
-    file->position += entry->size;
-    file->position = align(file->position, 4);
+    for (Uint32 ii = ext.numFiles; ii < numFiles; ++ii) {
+        files[ii].id = ii;
+        files[ii].isOpened = false;
+        files[ii].buffer = NULL;
+    }
 
-    //printf("readNDE: pos = %#x\n", file->position);
+    ext.files = files;
+    ext.numFiles = numFiles;
 
     return true;
 }
 
+/*
+ * Make sure the buffer holds the block containing file->position
+ */
 Bool ext_getCorrectBlock(File* file)
 {
-    const Uint32 BLOCK_NUMS_PER_BLOCK = ext.blockSize / sizeof(Uint32);
-    const Uint32 SI_BASE_BLOCK = 12;
-    const Uint32 DI_BASE_BLOCK = SI_BASE_BLOCK + BLOCK_NUMS_PER_BLOCK;
-    const Uint32 TI_BASE_BLOCK = DI_BASE_BLOCK + BLOCK_NUMS_PER_BLOCK * BLOCK_NUMS_PER_BLOCK;
-
-    Uint32 requiredBlockInFile = file->position / ext.blockSize;
+    Uint32 requiredBlockInFile = file->position >> ext.logBlockSize;
 
     if (file->blockInBuffer == requiredBlockInFile) {
         return true;
     }
 
-    //printf("Required block = %#x, current block = %#x\n", requiredBlockInFile, file->blockInBuffer);
+    if (file->buffer == NULL) {
+        file->buffer = alloc(ext.blockSize);
+    }
+
+    LOG_TRACE("Required block = %#x, current block = %#x\n", requiredBlockInFile, file->blockInBuffer);
     Uint32 blockNum;
-    if (requiredBlockInFile < SI_BASE_BLOCK) {
-        // The required block pointer is in the direct pointers
+    Uint32 runLength;
+    if (!ext_mapBlock(file, requiredBlockInFile, &blockNum, &runLength)) {
+        return false;
+    }
+
+    if (blockNum == 0) {
+        // A hole or an uninitialized extent. Either way it reads as zeros
+        memset(file->buffer, 0, ext.blockSize);
+    } else if (!ext_readBlock(&ext.disk, blockNum, file->buffer)) {
+        LOG_ERROR("ext_getCorrectBlock: Failed to read block %#x\n", blockNum);
+        return false;
+    }
+
+    file->blockInBuffer = requiredBlockInFile;
+
+    return true;
+}
+
+/*
+ * Find the disk block holding block blockInFile of file
+ *
+ * *runLength is set to the number of blocks from blockInFile known to follow on contiguously
+ * A *blockNum of zero means the blocks are a hole and read as zeros
+ *
+ * For block mapped files the first 12 blocks are listed in the inode. After them come the blocks
+ * reached through the singly, doubly and triply indirect blocks, each level multiplying the reach
+ * by the number of pointers in a block
+ */
+Bool ext_mapBlock(File* file, Uint32 blockInFile, Uint32* blockNum, Uint32* runLength)
+{
+    const Uint8 POINTER_SHIFT = ext.logBlockSize - 2;   // log2 of the block pointers per block
+    const Uint32 POINTER_MASK = (1 << POINTER_SHIFT) - 1;
+
+    if (file->inode.flags & IN_FLAG_EXTENTS) {
+        return ext_mapExtent(file, blockInFile, blockNum, runLength);
+    }
 
-        blockNum = file->inode.directBlocks[requiredBlockInFile];
+    if (blockInFile < NUM_DIRECT_BLOCKS_IN_INODE) {
+        // The inode is packed, so copy the pointers out rather than pass a possibly unaligned pointer
+        Uint32 directBlocks[NUM_DIRECT_BLOCKS_IN_INODE];
+        memcpy(directBlocks, file->inode.directBlocks, sizeof(directBlocks));
 
-    } else if (requiredBlockInFile < DI_BASE_BLOCK) {
-        // SI_BASE_BLOCK < required block pointer < DI_BASE_BLOCK
-        // The required block pointer is in the singly indirect pointers
+        *blockNum = directBlocks[blockInFile];
+        *runLength = ext_countRun(directBlocks, blockInFile, NUM_DIRECT_BLOCKS_IN_INODE);
+        return true;
+    }
 
-        if (!ext_readBlock(&ext.disk, file->inode.singlyIndirectBlock, file->buffer)) {
-            printf("ext_openFile: Failed to read inode singly indirect block %#x\n", blockNum);
+    // Work out the level of indirection and the index within that level's tree
+    Uint64 index = blockInFile - NUM_DIRECT_BLOCKS_IN_INODE;
+    Uint32 root;
+    int levels;
+
+    if (index < (1ULL << POINTER_SHIFT)) {
+        root = file->inode.singlyIndirectBlock;
+        levels = 1;
+    } else if ((index -= 1ULL << POINTER_SHIFT) < (1ULL << (2 * POINTER_SHIFT))) {
+        root = file->inode.doublyIndirectBlock;
+        levels = 2;
+    } else {
+        index -= 1ULL << (2 * POINTER_SHIFT);
+        root = file->inode.triplyIndirectBlock;
+        levels = 3;
+    }
+
+    // Walk down the tree taking POINTER_SHIFT bits of the index per level, most significant first
+    Uint32 block = root;
+    for (int depth = 0; depth < levels; ++depth) {
+        if (block == 0) {
+            // A zero pointer is a hole covering everything below it. Clamp the run to what a Uint32 holds
+            Uint64 span = 1ULL << (POINTER_SHIFT * (levels - depth));
+            Uint64 run = span - (index & (span - 1));
+            *blockNum = 0;
+            *runLength = (run > UINT32_MAX) ? UINT32_MAX : run;
+            return true;
+        }
+
+        Uint32* pointers = ext_readIndirectBlock(depth, block);
+        if (pointers == NULL) {
             return false;
         }
 
-        Uint32* siBlock = ((Uint32*) file->buffer);
-        Uint32 siBlockIndex = requiredBlockInFile - SI_BASE_BLOCK;
-        blockNum = siBlock[siBlockIndex];
-        //printf("SIP %#x at bn = %#x\n", requiredBlockInFile, blockNum);
+        Uint32 slot = (Uint32) (index >> (POINTER_SHIFT * (levels - 1 - depth))) & POINTER_MASK;
+        block = pointers[slot];
 
-    } else if (blockNum < TI_BASE_BLOCK) {
-        // DI_BASE_BLOCK < required block pointer < TI_BASE_BLOCK
-        // The required block pointer is in the doubly indirect pointers
+        if (depth == levels - 1) {
+            *runLength = ext_countRun(pointers, slot, POINTER_MASK + 1);
+        }
+    }
 
-        if (!ext_readBlock(&ext.disk, file->inode.doublyIndirectBlock, file->buffer)) {
-            printf("ext_openFile: Failed to read inode doubly indirect block, block = %#x\n", blockNum);
-            return false;
+    *blockNum = block;
+    return true;
+}
+
+/*
+ * Count how many pointers from pointers[index] onwards, before limit, name consecutive blocks
+ * A run of zero pointers is a run of holes
+ */
+Uint32 ext_countRun(Uint32* pointers, Uint32 index, Uint32 limit)
+{
+    Uint32 first = pointers[index];
+    Uint32 run = 1;
+
+    while (index + run < limit && pointers[index + run] == (first != 0 ? first + run : 0)) {
+        ++run;
+    }
+
+    return run;
+}
+
+/*
+ * ext_mapBlock for extent mapped files
+ *
+ * Sequential reads stay within one extent for up to 32768 blocks, so the last extent found is
+ * remembered in the File and the tree is only walked when we step outside it. Tree nodes below
+ * the root come through the same per-depth cache as indirect blocks, so the current leaf stays resident
+ */
+Bool ext_mapExtent(File* file, Uint32 blockInFile, Uint32* blockNum, Uint32* runLength)
+{
+    if (file->extentLength == 0 || blockInFile - file->extentFileBlock >= file->extentLength) {
+        ExtentHeader* header = (ExtentHeader*) file->inode.directBlocks;
+
+        for (int depth = 0; ; ++depth) {
+            if (header->magic != EXTENT_MAGIC || depth >= MAX_CACHED_DEPTH) {
+                LOG_ERROR("ext_mapExtent: Bad extent node, magic = %#x, depth = %d\n", header->magic, depth);
+                return false;
+            }
+
+            int ii = ext_searchExtentNode(header, blockInFile);
+
+            if (header->depth == 0) {
+                Extent* extents = (Extent*) (header + 1);
+                Uint32 length = (ii >= 0) ? extents[ii].length : 0;
+                Bool initialized = length <= EXTENT_MAX_INIT_LENGTH;
+                if (!initialized) {
+                    length -= EXTENT_MAX_INIT_LENGTH;
+                }
+
+                if (ii < 0 || blockInFile - extents[ii].fileBlock >= length) {
+                    // A hole. It runs up to the next extent
+                    *blockNum = 0;
+                    *runLength = (ii + 1 < header->numEntries) ? extents[ii + 1].fileBlock - blockInFile : 1;
+                    return true;
+                }
+
+                if (extents[ii].startHigh != 0) {
+                    LOG_ERROR("ext_mapExtent: Extent beyond 2^32 blocks not supported\n");
+                    return false;
+                }
+
+                file->extentFileBlock = extents[ii].fileBlock;
+                file->extentLength = length;
+                file->extentStart = initialized ? extents[ii].startLow : 0;
+                break;
+            }
+
+            ExtentIndex* indexes = (ExtentIndex*) (header + 1);
+            if (ii < 0) {
+                // Before the first child. A hole up to the start of it
+                *blockNum = 0;
+                *runLength = indexes[0].fileBlock - blockInFile;
+                return true;
+            }
+
+            header = (ExtentHeader*) ext_readIndirectBlock(depth, indexes[ii].leafLow);
+            if (header == NULL) {
+                return false;
+            }
         }
+    }
 
-        Uint32* diBlock = ((Uint32*) file->buffer);
-        Uint32 diBlockIndex = (requiredBlockInFile - DI_BASE_BLOCK) / BLOCK_NUMS_PER_BLOCK;
-        Uint32 siBlockIndex = diBlock[diBlockIndex];
+    Uint32 offset = blockInFile - file->extentFileBlock;
+    *blockNum = (file->extentStart != 0) ? file->extentStart + offset : 0;
+    *runLength = file->extentLength - offset;
 
-        if (!ext_readBlock(&ext.disk, siBlockIndex, file->buffer)) {
-            printf("ext_openFile: Failed to read inode doubly indirect block, block = %#x\n", blockNum);
-            return false;
+    return true;
+}
+
+/*
+ * Binary search a node for the last entry starting at or before blockInFile
+ *
+ * Index and leaf entries are both 12 bytes and start with the first file block they cover,
+ * so the same search does for both. Returns -1 if blockInFile is before the first entry
+ */
+int ext_searchExtentNode(ExtentHeader* header, Uint32 blockInFile)
+{
+    Extent* entries = (Extent*) (header + 1);
+    int low = 0;
+    int high = header->numEntries - 1;
+    int found = -1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (entries[mid].fileBlock <= blockInFile) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
         }
+    }
 
-        Uint32* siBlock = ((Uint32*) file->buffer);
-        siBlockIndex = (requiredBlockInFile - DI_BASE_BLOCK) % BLOCK_NUMS_PER_BLOCK;
-        blockNum = siBlock[siBlockIndex];
+    return found;
+}
+
+/*
+ * Read as many whole blocks as we can, starting at the current position, straight into buff
+ *
+ * The read covers as much of the contiguous run at the position as count allows, in one disk request
+ * Holes are zero filled without any I/O
+ * Below 1MB the BIOS reads directly into buff, up to its per call limit.
+ * Above 1MB, where the BIOS can't reach, the run is staged through the bounce buffer
+ *
+ * Returns the number of bytes read. Zero means the caller should go through the block buffer instead
+ */
+Uint32 ext_readRun(File* file, Uint8* buff, Uint32 count)
+{
+    Uint32 blockNum;
+    Uint32 runLength;
+
+    if (!ext_mapBlock(file, file->position >> ext.logBlockSize, &blockNum, &runLength)) {
+        return 0;
+    }
+
+    Uint32 blocks = count >> ext.logBlockSize;
+    if (blocks > runLength) {
+        blocks = runLength;
+    }
+
+    if (blockNum == 0) {
+        memset(buff, 0, blocks << ext.logBlockSize);
+        return blocks << ext.logBlockSize;
+    }
+
+    Uint8* target = buff;
+    Uint32 maxBlocks = MAX_SECTORS_PER_READ / ext.sectorsPerBlock;
+
+    if ((Uint32) buff + ext.blockSize <= BIOS_BUFFER_LIMIT) {
+        if (maxBlocks > (BIOS_BUFFER_LIMIT - (Uint32) buff) >> ext.logBlockSize) {
+            maxBlocks = (BIOS_BUFFER_LIMIT - (Uint32) buff) >> ext.logBlockSize;
+        }
     } else {
-        panic("Triply indirect inode pointers not implemented yet");
+        target = ext.bounceBuffer;
+        if (maxBlocks > BOUNCE_BUFFER_SIZE >> ext.logBlockSize) {
+            maxBlocks = BOUNCE_BUFFER_SIZE >> ext.logBlockSize;
+        }
     }
 
-    if (!ext_readBlock(&ext.disk, blockNum, file->buffer)) {
-        printf("ext_openFile: Failed to read inode block %#x\n", blockNum);
-        return false;
+    if (blocks > maxBlocks) {
+        blocks = maxBlocks;
     }
 
-    file->blockInBuffer = requiredBlockInFile;
+    if (blocks == 0 || !diskExtRead(&ext.disk, blockNum * ext.sectorsPerBlock, blocks * ext.sectorsPerBlock, target)) {
+        return 0;
+    }
 
-    return true;
+    if (target != buff) {
+        memcpy(buff, target, blocks << ext.logBlockSize);
+    }
+
+    return blocks << ext.logBlockSize;
+}
+
+/*
+ * Return the block pointers in block, reading it into the cache for depth if it isn't already there
+ */
+Uint32* ext_readIndirectBlock(int depth, Uint32 block)
+{
+    IndirectCache* cache = &ext.indirect[depth];
+
+    if (cache->block != block) {
+        if (!ext_readBlock(&ext.disk, block, cache->pointers)) {
+            LOG_ERROR("ext_readIndirectBlock: Failed to read indirect block %#x at depth %d\n", block, depth);
+            cache->block = 0;
+            return NULL;
+        }
+        cache->block = block;
+    }
+
+    return cache->pointers;
 }
 
 void ext_closeFile(File* file)
 {
+    if (file->buffer != NULL) {
+        free(file->buffer);
+        file->buffer = NULL;
+    }
+
     file->isOpened = false;
 }
 
@@ -611,12 +1604,12 @@ void ext_printDirectoryEntry(DirectoryEntry* entry)
 
 void ext_printFile(File* file)
 {
-    printf("File: id=%d, isOpened=%d, pos=%d, cbif=%d, size=%d, tap=%#x, db0=%#x, sidb=%#x\n",
+    printf("File: id=%d, isOpened=%d, pos=%llu, cbif=%d, size=%llu, tap=%#x, db0=%#x, sidb=%#x\n",
         file->id,
         file->isOpened,
         file->position,
         file->blockInBuffer,
-        file->inode.sizeLow,
+        file->size,
         file->inode.typeAndPermissions,
         file->inode.directBlocks[0],
         file->inode.singlyIndirectBlock);
@@ -2,6 +2,7 @@
 
 #include "stdtypes.h"
 #include "mbr.h"
+#include "vfstypes.h"
 
 #ifndef BAD_HANDLE
 typedef Int8 Handle;
@@ -11,5 +12,8 @@ typedef Int8 Handle;
 Bool extInitialize(Uint8 driveNumber, Partition* part);
 Handle extOpen(const char*);
 Uint32 extRead(Handle fin, Uint32 count, void* buff);
+Uint32 extReadAt(Handle fin, Uint64 offset, Uint32 count, void* buff);
 void extClose(Handle handle);
+Uint64 extGetSize(Handle handle);
+Uint32 extReadDir(Handle handle, VDirEntry* entries, Uint32 maxEntries);
 
@@ -1,5 +1,6 @@
 #include "stdtypes.h"
 #include "stdio.h"
+#include "log.h"
 #include "fat.h"
 #include "memdefs.h"
 #include "disk.h"
@@ -9,7 +10,8 @@
 #include "mbr.h"
 #include "alloc.h"
 
-#define MAX_HANDLES 3
+#define INITIAL_HANDLES 4
+#define MAX_HANDLES 127     // Handle is an Int8
 #define FAT_BUFFER_SIZE 2
 #define MBR_DISK_ADDRESS 0
 #define MBR_SIZE_SECTORS 1
@@ -102,10 +104,11 @@ typedef enum {
  */
 
 /*
- * There is one File per possible handle
- * They are stored in fat.files[handle]
+ * There is one File per handle
+ * They are stored in fat.files[handle], a table which grows when every handle is in use
  * Each File contains info needed for open and read functions
- *   including a pointer to a buffer on the heap which holds one sector of data
+ *   including a pointer to a buffer on the heap which holds one sector of data.
+ *   The buffer is allocated on the first read and freed on close
  */
 
 typedef struct {
@@ -115,8 +118,9 @@ typedef struct {
     Bool        isDir;              // True if a directory
     Uint32      firstCluster;       // First cluster
     Uint32      cluster;            // Current cluster
+    Uint32      clusterIndex;       // Position of the current cluster in the chain, from zero
     Uint8       sectorInCluster;    // Current sector within the current cluster
-    Uint32      sectorInBuffer;     // Sector LBA that is currently loaded in buffer
+    Uint32      sectorInBuffer;     // Sector within the file that is currently loaded in buffer
     Uint32      position;           // Current position in bytes
     Uint32      size;               // Maximum position in bytes (zero for directories)
     Uint8*      buffer;             // Point to current sector buffer
@@ -151,7 +155,9 @@ typedef struct {
     Uint32      fatLBA;             // LBA of FAT
     Uint32      rootDirLBA;         // LBA of root directory
     Uint32      dataLBA;            // LBA of data sectors
-    File        files[MAX_HANDLES]; // Array of Files. One for each possible handle value
+    Uint8*      walkBuffer;         // Sector buffer for the directories fatOpen walks through
+    File*       files;              // numFiles Files, indexed by handle
+    Uint32      numFiles;
 } FatData;
 
 /*
@@ -164,16 +170,18 @@ FatData fat;
  */
 
 FatType fat_getFatType(FatData* fat, BiosParameterBlock* bpb);
-File*   fat_openRootDir();
-File*   fat_openFile(DirectoryEntry* entry);
+void    fat_initRootDir(File* dir);
+void    fat_initFile(File* file, DirectoryEntry* entry);
 Uint32  fat_readFile(File* file, Uint32 count, Uint8* buff);
 void    fat_closeFile(File* file);
 Handle  fat_getFreeHandle();
+Bool    fat_growFileTable();
 Bool    fat_findFileInDirectory(const char* name, File* dir, DirectoryEntry* foundEntry);
 Bool    fat_readDirEntry(File* dir, DirectoryEntry* entry);
-Bool    fat_readNextSector(File* dir);
-Bool    fat_readNextSectorFromFAT1216RootDir(File* dir);
-Bool    fat_readNextSectorFromFile(File* file);
+void    fat_fillDirEntry(DirectoryEntry* entry, VDirEntry* vEntry);
+Bool    fat_getCorrectSector(File* file);
+Bool    fat_readSectorFromFAT1216RootDir(File* dir, Uint32 sector);
+Bool    fat_readSectorFromFile(File* file, Uint32 sectorInFile);
 Uint32  fat_getNextClusterNumber(Uint32 current);
 Uint32  fat_clusterToLBA(Uint32 cluster);
 void    fat_convert8D3ToString(const char* name, char* out);
@@ -201,11 +209,11 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
 {
     // Initialize disk
     if (!diskInit(&fat.disk, driveNumber, part)) {
-        printf("Failed to initialize disk %d\n", driveNumber);
+        LOG_ERROR("Failed to initialize disk %d\n", driveNumber);
         return false;
     }
 
-    printf("Drive %#x, Cylinders = %d, Heads = %d, Sectors = %d, bps = %d, offset = %d (%#x)\n",
+    LOG_INFO("Drive %#x, Cylinders = %d, Heads = %d, Sectors = %d, bps = %d, offset = %d (%#x)\n",
         fat.disk.id,
         fat.disk.numCylinders,
         fat.disk.numHeads,
@@ -217,16 +225,16 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
     // Grab what we need from the boot sector
     BiosParameterBlock* bpb = alloc(fat.disk.bytesPerSector);
     if (!diskExtRead(&fat.disk, MBR_DISK_ADDRESS, MBR_SIZE_SECTORS, (Uint8*) bpb)) {
-        printf("Failed to read boot sector of disk %d\n", driveNumber);
+        LOG_ERROR("Failed to read boot sector of disk %d\n", driveNumber);
         panic("Failed to load FAT boot sector");
         return false;
     }
-    printf("bpb = %p\n", bpb);
-    printHeap();
-    fat_printBPB(bpb);
+    LOG_DEBUG("bpb = %p\n", bpb);
+    LOG_DUMP(LOG_LEVEL_DEBUG, printHeap());
+    LOG_DUMP(LOG_LEVEL_DEBUG, fat_printBPB(bpb));
 
     EBR32* ebr = (EBR32*) (((Uint8*)bpb) + sizeof(BiosParameterBlock));
-    fat_printEBR32(ebr);
+    LOG_DUMP(LOG_LEVEL_DEBUG, fat_printEBR32(ebr));
 
     // Validation checks
     if (bpb->bytesPerSector == 0
@@ -236,7 +244,7 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
     }
 
     if (bpb->bytesPerSector != fat.disk.bytesPerSector) {
-        printf("Disk params and BPB disagree on bytes per sector: disk: %d, bpb: %d\n",
+        LOG_ERROR("Disk params and BPB disagree on bytes per sector: disk: %d, bpb: %d\n",
                fat.disk.bytesPerSector,
                fat.bytesPerSector);
                panic("Fatal error!");
@@ -250,7 +258,7 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
     fat.rootCluster = ebr->rootCluster;
 
     fat.fatType = fat_getFatType(&fat, bpb);
-    printf("Found FAT Type = %d\n", fat.fatType);
+    LOG_INFO("Found FAT Type = %d\n", fat.fatType);
     switch (fat.fatType)
     {
         case FAT12: fat.endClusterMarker = 0xFF8; break;
@@ -268,7 +276,7 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
     Uint32 rootDirSizeInSectors = divAndRoundUp(rootDirSizeInBytes, fat.bytesPerSector);
     fat.dataLBA = fat.rootDirLBA + rootDirSizeInSectors;
 
-    printf("fatLBA = %#x, rootDirLBA = %#x, dataLBA = %#x\n", fat.fatLBA, fat.rootDirLBA, fat.dataLBA);
+    LOG_DEBUG("fatLBA = %#x, rootDirLBA = %#x, dataLBA = %#x\n", fat.fatLBA, fat.rootDirLBA, fat.dataLBA);
 
     free(bpb); bpb = NULL;
 
@@ -276,11 +284,13 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
     fat.FAT = alloc(FAT_BUFFER_SIZE * fat.bytesPerSector);
     fat.currentFATSector = UINT32_MAX; // Force a cache miss and load
 
-    // Set up File table
-    for (int ii = 0; ii < MAX_HANDLES; ++ii) {
-        fat.files[ii].id = ii;
-        fat.files[ii].isOpened = false;
-        fat.files[ii].buffer = alloc(fat.bytesPerSector);
+    fat.walkBuffer = alloc(fat.bytesPerSector);
+
+    // Set up File table. It grows as handles are needed
+    fat.files = NULL;
+    fat.numFiles = 0;
+    if (!fat_growFileTable()) {
+        return false;
     }
 
     return true;
@@ -294,18 +304,16 @@ Bool fatInitialize(Uint8 driveNumber, Partition* part)
 Handle fatOpen(const char* path)
 {
     if (path == NULL || path[0] == '\0') {
-        printf("Failed to open file with empty path\n");
+        LOG_ERROR("Failed to open file with empty path\n");
         return BAD_HANDLE;
     }
 
     const char* originalPath = path;
     
-    File* file = fat_openRootDir();
-
-    if (file == NULL) {
-        printf("Failed to open the root directory\n");
-        return BAD_HANDLE;
-    }
+    // Directories along the way are walked in a local File so they don't take up handles
+    File walk;
+    walk.buffer = fat.walkBuffer;
+    fat_initRootDir(&walk);
 
     if (path[0] == '/') {
         path++; // Skip leading '/'
@@ -315,25 +323,22 @@ Handle fatOpen(const char* path)
         char component[13]; // 8 + '.' + 3 + null
         path = getComponent(path, component, '/', sizeof(component));
         if (*path != '\0' && *path != '/') {
-            printf("Failed to open file '%s': Component '%s' is too long\n", originalPath, component);
-            fat_closeFile(file);
+            LOG_ERROR("Failed to open file '%s': Component '%s' is too long\n", originalPath, component);
             return BAD_HANDLE;
         }
 
         DirectoryEntry entry;
-        if (!fat_findFileInDirectory(component, file, &entry)) {
-            printf("Failed to open file '%s': Could not find '%s'\n", originalPath, component);
-            fat_closeFile(file);
+        if (!fat_findFileInDirectory(component, &walk, &entry)) {
+            LOG_ERROR("Failed to open file '%s': Could not find '%s'\n", originalPath, component);
             return BAD_HANDLE;
         }
 
-        //printf("fatOpen: ");
-        //fat_printDirectoryEntry(&entry);
+        LOG_TRACE("fatOpen: ");
+        LOG_DUMP(LOG_LEVEL_TRACE, fat_printDirectoryEntry(&entry));
 
-        fat_closeFile(file);                     // close parent directory
-        file = fat_openFile(&entry);  // open child (file or dir)
-        //printf("fatOpen: ");
-        //fat_printFile(file);
+        fat_initFile(&walk, &entry);    // switch to child (file or dir)
+        LOG_TRACE("fatOpen: ");
+        LOG_DUMP(LOG_LEVEL_TRACE, fat_printFile(&walk));
 
         if (*path == '\0') {
             break;
@@ -341,13 +346,28 @@ Handle fatOpen(const char* path)
 
         path++;     // skip '/'
 
-        if (!file->isDir) {
-            printf("Failed to open file '%s': Component '%s' is not a directory\n", originalPath, component);
-            fat_closeFile(file);
+        if (!walk.isDir) {
+            LOG_ERROR("Failed to open file '%s': Component '%s' is not a directory\n", originalPath, component);
+            return BAD_HANDLE;
         }
     }
-    //printf("fatOpen returning id=%d\n", file->id);
-    fat_printFile(file);
+
+    // Only now that we have found it does the file take a handle
+    Handle handle = fat_getFreeHandle();
+    if (handle == BAD_HANDLE) {
+        return BAD_HANDLE;
+    }
+
+    File* file = &fat.files[handle];
+    memcpy(file, &walk, sizeof(File));
+    file->id = handle;
+    file->isOpened = true;
+    file->buffer = NULL;
+    file->sectorInBuffer = UINT32_MAX;
+    file->position = 0;
+
+    LOG_TRACE("fatOpen returning id=%d\n", file->id);
+    LOG_DUMP(LOG_LEVEL_DEBUG, fat_printFile(file));
     return file->id;
 }
 
@@ -362,6 +382,30 @@ Uint32 fatRead(Handle handle, Uint32 count, void* buff)
     return fat_readFile(&fat.files[handle], count, buff);
 }
 
+/*
+ * Read count bytes from offset within the file open on handle into buff
+ *
+ * The handle's own position is left where it was
+ * Returns number of bytes read
+ */
+Uint32 fatReadAt(Handle handle, Uint64 offset, Uint32 count, void* buff)
+{
+    File* file = &fat.files[handle];
+
+    if (offset > UINT32_MAX || (!file->isDir && offset >= file->size)) {
+        return 0;
+    }
+
+    Uint32 position = file->position;
+    file->position = offset;
+
+    Uint32 bytesRead = fat_readFile(file, count, buff);
+
+    file->position = position;
+
+    return bytesRead;
+}
+
 /*
  * Close handle
  */
@@ -370,6 +414,60 @@ void fatClose(Handle handle)
     fat_closeFile(&fat.files[handle]);
 }
 
+/*
+ * Size in bytes of the file open on handle. Zero for directories
+ */
+Uint64 fatGetSize(Handle handle)
+{
+    return fat.files[handle].size;
+}
+
+/*
+ * Fill entries with up to maxEntries entries of the directory open on handle
+ *
+ * Entries are decoded straight out of the sector buffer, a sector at a time
+ * Free entries, long file name entries and the volume label are skipped
+ *
+ * Returns the number of entries filled. Zero at the end of the directory or on error
+ */
+Uint32 fatReadDir(Handle handle, VDirEntry* entries, Uint32 maxEntries)
+{
+    File* dir = &fat.files[handle];
+
+    if (!dir->isDir) {
+        LOG_ERROR("fatReadDir: Handle %d is not a directory\n", handle);
+        return 0;
+    }
+
+    Uint32 numEntries = 0;
+
+    while (numEntries < maxEntries) {
+        if (!fat_getCorrectSector(dir)) {
+            break;
+        }
+
+        DirectoryEntry* entry = (DirectoryEntry*) (dir->buffer + (dir->position % fat.bytesPerSector));
+        DirectoryEntry* end = (DirectoryEntry*) (dir->buffer + fat.bytesPerSector);
+
+        for (; entry < end && numEntries < maxEntries; ++entry) {
+            if (entry->name[0] == '\0') {
+                return numEntries;      // All remaining entries are free. Stay here so later calls return zero
+            }
+
+            dir->position += sizeof(DirectoryEntry);
+
+            // E5 marks a free entry. Long file name entries have all of the volume ID attribute bits set
+            if (entry->name[0] == 0xE5 || (entry->attributes & FAT_ATTRIBUTE_VOLUME_ID) != 0) {
+                continue;
+            }
+
+            fat_fillDirEntry(entry, &entries[numEntries++]);
+        }
+    }
+
+    return numEntries;
+}
+
 // ###############################################
 //      Private functions
 // ###############################################
@@ -392,7 +490,7 @@ FatType fat_getFatType(FatData* fat, BiosParameterBlock* bpb)
 
     Uint32 numClusters = dataSectors / bpb->sectorsPerCluster;
 
-    printf("GFT: rds=%d, spf=%d, ts=%d, ds=%d, nc=%d\n",
+    LOG_DEBUG("GFT: rds=%d, spf=%d, ts=%d, ds=%d, nc=%d\n",
         rootDirSectors, fat->sectorsPerFat, fat->totalSectors, dataSectors, numClusters);
 
     if (numClusters < 4085) {
@@ -411,7 +509,7 @@ bool readFATSectorForIndex(Uint32 index)
     Uint32 sector = index / fat.bytesPerSector;
 
     if (sector >= fat.sectorsPerFat) {
-        printf("readFATSectorForIndex: Requested sector invalid: index=%x, sector=%x, spf=%x\n", index, sector, fat.sectorsPerFat);
+        LOG_ERROR("readFATSectorForIndex: Requested sector invalid: index=%x, sector=%x, spf=%x\n", index, sector, fat.sectorsPerFat);
         return false;
     }
 
@@ -420,37 +518,31 @@ bool readFATSectorForIndex(Uint32 index)
         return true;
     }
 
-    //printf("Loading FAT %#x for index = %#x\n", fat.fatLBA + sector, index);
+    LOG_TRACE("Loading FAT %#x for index = %#x\n", fat.fatLBA + sector, index);
     if (!diskExtRead(
             &fat.disk,
             fat.fatLBA + sector,
             FAT_BUFFER_SIZE,            // TODO: Danger of reading past FAT end
             (Uint8*) fat.FAT)) {
-        printf("Failed to read sectors %d-%d FAT\n", sector, sector+FAT_BUFFER_SIZE);
+        LOG_ERROR("Failed to read sectors %d-%d FAT\n", sector, sector+FAT_BUFFER_SIZE);
         panic("Can't read FAT");
         return false;
     }
-    sector = fat.currentFATSector;
-    //fat_printFAT();
+    fat.currentFATSector = sector;
+    LOG_DUMP(LOG_LEVEL_TRACE, fat_printFAT());
 
     return true;
 }
 
-File* fat_openRootDir()
+/*
+ * Point dir at the root directory, positioned at the start. The buffer is left alone
+ */
+void fat_initRootDir(File* dir)
 {
-    File* dir;
-
-    int handle = fat_getFreeHandle();
-    if (handle == BAD_HANDLE) {
-        return NULL;
-    }
-
-    dir = &fat.files[handle];
-    dir->id = handle;
-    dir->isOpened = true;
     dir->isRootDir = true;
     dir->isDir = true;
     dir->cluster = 0;
+    dir->clusterIndex = 0;
     dir->sectorInCluster = 0;
     dir->sectorInBuffer = UINT32_MAX;   // This will force a sector load on first read attempt
     dir->position = 0;
@@ -461,35 +553,28 @@ File* fat_openRootDir()
     } else {
         dir->firstCluster = 0;                      // N/A for the root dir
     }
-
-    return dir;
 }
 
 /*
- * Open a file or directory (just not a FAT12/16 root directory)
+ * Point file at a file or directory (just not a FAT12/16 root directory), positioned at the start
+ * The buffer is left alone
  */
-File* fat_openFile(DirectoryEntry* entry)
+void fat_initFile(File* file, DirectoryEntry* entry)
 {
-    Handle handle = fat_getFreeHandle();
-    if (handle == BAD_HANDLE) {
-        return NULL;
+    if ((entry->attributes & FAT_ATTRIBUTE_DIRECTORY) && entry->firstClusterLow == 0 && entry->firstClusterHigh == 0) {
+        fat_initRootDir(file);      // A ".." leading back to the root names cluster zero
+        return;
     }
 
-    File* file = &fat.files[handle];
-
-    file->id = handle;
-    file->isOpened = true;
     file->isRootDir = false;
     file->isDir = (entry->attributes & FAT_ATTRIBUTE_DIRECTORY) != 0;
     file->firstCluster = entry->firstClusterLow + (((Uint32)entry->firstClusterHigh) << 16);
     file->cluster = 0;                          // Cause first read to read from firstCluster
+    file->clusterIndex = 0;
     file->sectorInCluster = 0;
     file->sectorInBuffer = UINT32_MAX;          // This will force a sector load on first read attempt
     file->position = 0;
     file->size = entry->size;
-
-    printf("Opened handle %d\n", handle);
-    return file;
 }
 
 /*
@@ -497,38 +582,28 @@ File* fat_openFile(DirectoryEntry* entry)
  */
 Uint32 fat_readFile(File* file, Uint32 count, Uint8* buff)
 {
-    //printf("fat_readFile: Requesting to read %ld bytes from file %d\n", count, file->id);
-    //fat_printFile(file);
+    LOG_TRACE("fat_readFile: Requesting to read %ld bytes from file %d\n", count, file->id);
+    LOG_DUMP(LOG_LEVEL_TRACE, fat_printFile(file));
 
     // If this a regular file then read as far as size.
     // If this is a directory then read to the end of the last sector in the cluster sequence
     if (!file->isDir) {
-        Uint32 remainingInFile = file->size - file->position;
+        Uint32 remainingInFile = (file->position < file->size) ? file->size - file->position : 0;
         if (remainingInFile < count) {
             count = remainingInFile;
         }
     }
 
     if (count == 0) {
-        printf("EOF\n");
+        LOG_TRACE("EOF\n");
         return 0;
     }
 
     Uint32 bytesRead = 0;
 
     while (bytesRead < count) {
-        if (file->position / fat.bytesPerSector != file->sectorInBuffer) {
-            /*
-             * FAT filesystems are designed for sequential reads; they use a list of clusters
-             * To support seeking to other positions in the file would require traversing the list
-             * from the beginning each time we don't have the correct sector to locate the correct cluster
-             * 
-             * For our purposes, we will always be reading sequentially.
-             * So if the sectorInBuffer isn't what we want then we assume the next one will be!
-             */
-            if(!fat_readNextSector(file)) {
-                return bytesRead;
-            }
+        if (!fat_getCorrectSector(file)) {
+            return bytesRead;
         }
 
         Uint32 bytesToRead = count - bytesRead;
@@ -537,39 +612,78 @@ Uint32 fat_readFile(File* file, Uint32 count, Uint8* buff)
             bytesToRead = fat.bytesPerSector - positionInSector;
         }
 
-        //printf("Copying %ld bytes, from %lx to %lx\n", bytesToRead, file->buffer + positionInSector, buff + bytesRead);
+        LOG_TRACE("Copying %ld bytes, from %lx to %lx\n", bytesToRead, file->buffer + positionInSector, buff + bytesRead);
         memcpy(buff + bytesRead, file->buffer + positionInSector, bytesToRead);
 
         file->position  += bytesToRead;
         bytesRead += bytesToRead;
     }
 
-    //printf("Total read = %ld\n", bytesRead);
+    LOG_TRACE("Total read = %ld\n", bytesRead);
     return bytesRead;
 }
 
 void fat_closeFile(File* file)
 {
+    if (file->buffer != NULL) {
+        free(file->buffer);
+        file->buffer = NULL;
+    }
+
     file->isOpened = false;
 }
 
 Handle fat_getFreeHandle()
 {
     Handle handle;
-    for (handle = 0; handle < MAX_HANDLES; ++handle) {
+    for (handle = 0; handle < fat.numFiles; ++handle) {
         if(!fat.files[handle].isOpened) {
             break;
         }
     }
 
-    if (handle == MAX_HANDLES) {
-        printf("Ran out of file handles\n");
+    if (handle == fat.numFiles && !fat_growFileTable()) {
         return BAD_HANDLE;
     }
 
     return handle;
 }
 
+/*
+ * Double the File table, up to MAX_HANDLES
+ *
+ * The table moves, so no File* may be held across a call that can take a new handle
+ */
+Bool fat_growFileTable()
+{
+    Uint32 numFiles = (fat.numFiles == 0) ? INITIAL_HANDLES : fat.numFiles * 2;
+    if (numFiles > MAX_HANDLES) {
+        numFiles = MAX_HANDLES;
+    }
+
+    if (numFiles <= fat.numFiles) {
+        LOG_ERROR("Ran out of file handles\n");
+        return false;
+    }
+
+    File* files = alloc(numFiles * sizeof(File));
+    if (fat.files != NULL) {
+        memcpy(files, fat.files, fat.numFiles * sizeof(File));
+        free(fat.files);
+    }
+
+    for (Uint32 ii = fat.numFiles; ii < numFiles; ++ii) {
+        files[ii].id = ii;
+        files[ii].isOpened = false;
+        files[ii].buffer = NULL;
+    }
+
+    fat.files = files;
+    fat.numFiles = numFiles;
+
+    return true;
+}
+
 /*
  * Assumes dir is newly opened and hence position == 0
  */
@@ -590,15 +704,17 @@ Bool fat_findFileInDirectory(const char* name, File* dir, DirectoryEntry* foundE
         if (entry.name[0] == '\0') {
             break;      // name starting with '\0' signals all remaining entries are free
         }
-        //fat_printFile(dir);
-        printf("Comparing ");
-        fat_printFATName(entry.name);
-        printf(" to ");
-        fat_printFATName(fatName);
-        printf("\n");
+        LOG_DUMP(LOG_LEVEL_TRACE, fat_printFile(dir));
+        if (LOG_ENABLED(LOG_LEVEL_TRACE)) {
+            printf("Comparing ");
+            fat_printFATName(entry.name);
+            printf(" to ");
+            fat_printFATName(fatName);
+            printf("\n");
+        }
         if (memcmp(entry.name, fatName, 11) == 0) {
             *foundEntry = entry;
-            fat_printDirectoryEntry(foundEntry);
+            LOG_DUMP(LOG_LEVEL_DEBUG, fat_printDirectoryEntry(foundEntry));
             return true;
         }
     }
@@ -608,41 +724,63 @@ Bool fat_findFileInDirectory(const char* name, File* dir, DirectoryEntry* foundE
 
 Bool fat_readDirEntry(File* dir, DirectoryEntry* entry)
 {
-    // printf("RDE: ");
-    // fat_printFile(dir);
+    LOG_TRACE("RDE: ");
+    LOG_DUMP(LOG_LEVEL_TRACE, fat_printFile(dir));
 
-    if (dir->position / fat.bytesPerSector != dir->sectorInBuffer) {
-        if(!fat_readNextSector(dir)) {
-            return false;
-        }
+    if (!fat_getCorrectSector(dir)) {
+        return false;
     }
 
     *entry = *((DirectoryEntry*) (dir->buffer + (dir->position % fat.bytesPerSector)));
     dir->position  += sizeof(DirectoryEntry);
 
-    //fat_printDirectoryEntry(entry);
+    LOG_DUMP(LOG_LEVEL_TRACE, fat_printDirectoryEntry(entry));
 
     return true;
 }
 
-Bool fat_readNextSector(File* dir)
+void fat_fillDirEntry(DirectoryEntry* entry, VDirEntry* vEntry)
+{
+    vEntry->id = entry->firstClusterLow + (((Uint32)entry->firstClusterHigh) << 16);
+    vEntry->size = entry->size;
+    vEntry->type = (entry->attributes & FAT_ATTRIBUTE_DIRECTORY) ? VDIR_TYPE_DIR : VDIR_TYPE_FILE;
+    fat_convert8D3ToString((const char*) entry->name, vEntry->name);
+    vEntry->nameLength = strlen(vEntry->name);
+}
+
+/*
+ * Make sure the buffer holds the sector containing file->position
+ */
+Bool fat_getCorrectSector(File* file)
 {
-    if (dir->isRootDir && fat.fatType != FAT32) {
-        return fat_readNextSectorFromFAT1216RootDir(dir);
+    Uint32 sectorInFile = file->position / fat.bytesPerSector;
+
+    if (sectorInFile == file->sectorInBuffer) {
+        return true;
+    }
+
+    if (file->buffer == NULL) {
+        file->buffer = alloc(fat.bytesPerSector);
+    }
+
+    if (file->isRootDir && fat.fatType != FAT32) {
+        return fat_readSectorFromFAT1216RootDir(file, sectorInFile);
     } else {
-        return fat_readNextSectorFromFile(dir);
+        return fat_readSectorFromFile(file, sectorInFile);
     }
 }
 
-Bool fat_readNextSectorFromFAT1216RootDir(File* dir)
+Bool fat_readSectorFromFAT1216RootDir(File* dir, Uint32 sector)
 {
-    Uint16 sector = dir->position / fat.bytesPerSector;
+    if (fat.rootDirLBA + sector >= fat.dataLBA) {
+        return false;   // Past the end of the fixed size root directory
+    }
 
     if (!diskExtRead(&fat.disk,
                      fat.rootDirLBA + sector,
                      1,
                      dir->buffer)) {
-        printf("Failed to read Root directory, sector %d\n", sector);
+        LOG_ERROR("Failed to read Root directory, sector %d\n", sector);
         return false;
     }
 
@@ -651,39 +789,53 @@ Bool fat_readNextSectorFromFAT1216RootDir(File* dir)
     return true;
 }
 
-Bool fat_readNextSectorFromFile(File* file)
+/*
+ * Load sector sectorInFile of a file or directory (just not a FAT12/16 root directory)
+ *
+ * The FAT only links each cluster to the next, so finding the cluster holding a sector means
+ * walking the chain. We walk on from the current cluster when the sector is at or after it,
+ * which keeps sequential reads at one FAT lookup per cluster, and only go back to the first
+ * cluster when asked for something earlier
+ */
+Bool fat_readSectorFromFile(File* file, Uint32 sectorInFile)
 {
-    Uint32 nextCluster;
+    Uint32 clusterIndex = sectorInFile / fat.sectorsPerCluster;
 
-    if (file->cluster == 0) {
-        nextCluster = file->firstCluster;
-        file->sectorInCluster = 0;
-    } else if (file->sectorInCluster < fat.sectorsPerCluster - 1) {
-        nextCluster = file->cluster;
-        file->sectorInCluster++;
-    } else {
-        nextCluster = fat_getNextClusterNumber(file->cluster);
-        file->sectorInCluster = 0;
+    if (file->firstCluster < 2) {
+        return false;   // Empty file
     }
-    //printf("Current cluster = %#x, sic = %#x, next = %#x\n", file->cluster, file->sectorInCluster, nextCluster);
 
-    if (nextCluster >= fat.endClusterMarker) {
-        printf("reached end of cluster sequence\n");
-        return false;
+    if (file->cluster == 0 || clusterIndex < file->clusterIndex) {
+        file->cluster = file->firstCluster;
+        file->clusterIndex = 0;
     }
 
-    Uint32 lba = fat_clusterToLBA(nextCluster);
+    while (file->clusterIndex < clusterIndex) {
+        Uint32 nextCluster = fat_getNextClusterNumber(file->cluster);
+        LOG_TRACE("Current cluster = %#x, index = %#x, next = %#x\n", file->cluster, file->clusterIndex, nextCluster);
+
+        if (nextCluster >= fat.endClusterMarker) {
+            LOG_TRACE("reached end of cluster sequence\n");
+            return false;
+        }
+
+        file->cluster = nextCluster;
+        file->clusterIndex++;
+    }
+
+    file->sectorInCluster = sectorInFile % fat.sectorsPerCluster;
+
+    Uint32 lba = fat_clusterToLBA(file->cluster);
 
     if (!diskExtRead(&fat.disk,
                      lba + file->sectorInCluster,
                      1,
                      file->buffer)) {
-        printf("Failed to read file, lba %d\n", lba);
+        LOG_ERROR("Failed to read file, lba %d\n", lba);
         return false;
     }
 
-    file->cluster = nextCluster;
-    file->sectorInBuffer++;
+    file->sectorInBuffer = sectorInFile;
 
     return true;
 }
@@ -714,7 +866,7 @@ Uint32 fat_getNextClusterNumber(Uint32 current)
     
     case FAT16:
         next = *(Uint16*) &fat.FAT[index];
-        //printf("FAT16: index=%d, FAT = %p, [%x %x]\n", index, fat.FAT, fat.FAT[index], fat.FAT[index+1]);
+        LOG_TRACE("FAT16: index=%d, FAT = %p, [%x %x]\n", index, fat.FAT, fat.FAT[index], fat.FAT[index+1]);
         break;
     
     case FAT32:
@@ -722,14 +874,14 @@ Uint32 fat_getNextClusterNumber(Uint32 current)
         break;
     }
 
-    //printf("current = %x, next = %x\n", current, next);
+    LOG_TRACE("current = %x, next = %x\n", current, next);
     return next;
 }
 
 Uint32 fat_clusterToLBA(Uint32 cluster)
 {
     Uint32 lba = fat.dataLBA + (cluster - 2) * fat.sectorsPerCluster;
-    //printf("cluster = %#x => lba = %#x\n", cluster, lba);
+    LOG_TRACE("cluster = %#x => lba = %#x\n", cluster, lba);
 
     return lba;
 }
@@ -779,7 +931,7 @@ void fat_cconvertStringTo8D3(const char* name, char* out)
     }
 
     if (*name != '.' && *name != '\0') {
-        printf("Invalid file name component '%s'. Truncating\n", originalName);
+        LOG_WARNING("Invalid file name component '%s'. Truncating\n", originalName);
         *out++ = ' ';
         *out++ = ' ';
         *out++ = ' ';
@@ -796,7 +948,7 @@ void fat_cconvertStringTo8D3(const char* name, char* out)
             *out++ = ' ';
         }
         if (*name != '\0') {
-            printf("Invalid file name component '%s'. Truncating\n", originalName);
+            LOG_WARNING("Invalid file name component '%s'. Truncating\n", originalName);
         }
     }
 }
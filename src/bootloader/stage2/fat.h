@@ -3,6 +3,7 @@
 #include"stdtypes.h"
 #include "disk.h"
 #include "mbr.h"
+#include "vfstypes.h"
 
 #ifndef BAD_HANDLE
 typedef Int8 Handle;
@@ -12,4 +13,7 @@ typedef Int8 Handle;
 Bool fatInitialize(Uint8 driveNumber, Partition* part);
 Handle fatOpen(const char* path);
 Uint32 fatRead(Handle handle, Uint32 byteCount, void* buffer);
+Uint32 fatReadAt(Handle handle, Uint64 offset, Uint32 count, void* buff);
 void fatClose(Handle handle);
+Uint64 fatGetSize(Handle handle);
+Uint32 fatReadDir(Handle handle, VDirEntry* entries, Uint32 maxEntries);
@@ -0,0 +1,203 @@
+#include "fwcfg.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "log.h"
+#include "string.h"
+#include "x86.h"
+
+/*
+ * QEMU Firmware Configuration (fw_cfg) device
+ *
+ * https://www.qemu.org/docs/master/specs/fw_cfg.html
+ *
+ * QEMU exposes blobs to the guest through fw_cfg. Each blob is identified by a 16 bit selector
+ * Files given on the command line with
+ *      -fw_cfg name=opt/myos/kernel.elf,file=build/kernel.elf
+ * are listed in the file directory blob along with their selectors and sizes
+ *
+ * The traditional interface is a selector port and a data port which returns one byte per IN
+ * The DMA interface instead takes the address of a FwCfgDmaAccess and copies the whole transfer
+ * to its destination in a single operation. That lets us place the kernel and initrd at memory
+ * speed rather than going through emulated int 13h sector reads
+ *
+ * All multi-byte values in the DMA interface and the file directory are big endian
+ */
+
+#define FW_CFG_PORT_SELECTOR        0x510
+#define FW_CFG_PORT_DATA            0x511
+#define FW_CFG_PORT_DMA_HIGH        0x514
+#define FW_CFG_PORT_DMA_LOW         0x518   // Writing the low half starts the transfer
+
+#define FW_CFG_SIGNATURE            0x0000
+#define FW_CFG_ID                   0x0001
+#define FW_CFG_FILE_DIR             0x0019
+
+#define FW_CFG_SIGNATURE_VALUE      "QEMU"
+#define FW_CFG_ID_DMA               0x02
+#define FW_CFG_MAX_FILENAME         56
+
+enum {
+    FW_CFG_DMA_CTL_ERROR    = 0x01,
+    FW_CFG_DMA_CTL_READ     = 0x02,
+    FW_CFG_DMA_CTL_SKIP     = 0x04,
+    FW_CFG_DMA_CTL_SELECT   = 0x08
+};
+
+typedef struct {
+    Uint32  size;
+    Uint16  selector;
+    Uint16  reserved;
+    char    name[FW_CFG_MAX_FILENAME];
+} __attribute__((packed)) FwCfgDirEntry;
+
+typedef struct {
+    Uint32  control;
+    Uint32  length;
+    Uint64  address;
+} __attribute__((packed)) FwCfgDmaAccess;
+
+Bool fwcfgHasDMA = false;
+
+/*
+ * Forward declarations
+ */
+
+void   fwcfg_readBytes(Uint16 selector, void* buff, Uint32 count);
+Bool   fwcfg_dma(Uint32 control, Uint32 length, void* address);
+Uint32 fwcfg_bswap32(Uint32 value);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Returns true if we are running under QEMU with a DMA capable fw_cfg device
+ */
+Bool fwcfgInitialize()
+{
+    char signature[4];
+    fwcfg_readBytes(FW_CFG_SIGNATURE, signature, sizeof(signature));
+
+    if (memcmp(signature, FW_CFG_SIGNATURE_VALUE, sizeof(signature)) != 0) {
+        return false;
+    }
+
+    Uint32 id;
+    fwcfg_readBytes(FW_CFG_ID, &id, sizeof(id));   // The ID is little endian unlike everything else
+    fwcfgHasDMA = (id & FW_CFG_ID_DMA) != 0;
+
+    LOG_INFO("fw_cfg: found, id = %#x, DMA = %d\n", id, fwcfgHasDMA);
+
+    return fwcfgHasDMA;
+}
+
+/*
+ * Look up name, e.g. "opt/myos/kernel.elf", in the fw_cfg file directory
+ */
+Bool fwcfgFindFile(const char* name, FwCfgFile* file)
+{
+    Uint32 nameSize = strlen(name) + 1;
+    if (nameSize > FW_CFG_MAX_FILENAME) {
+        return false;
+    }
+
+    // The directory is a big endian count followed by that many entries
+    Uint32 count;
+    fwcfg_readBytes(FW_CFG_FILE_DIR, &count, sizeof(count));
+    count = fwcfg_bswap32(count);
+
+    for (Uint32 ii = 0; ii < count; ++ii) {
+        FwCfgDirEntry entry;
+        Uint8* bp = (Uint8*) &entry;
+        for (Uint32 jj = 0; jj < sizeof(FwCfgDirEntry); ++jj) {
+            bp[jj] = x86_inb(FW_CFG_PORT_DATA);     // Continue reading where the count left off
+        }
+
+        if (memcmp(entry.name, name, nameSize) == 0) {
+            file->selector = (entry.selector >> 8) | ((entry.selector & 0xFF) << 8);
+            file->size = fwcfg_bswap32(entry.size);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * DMA count bytes starting at offset within file directly to buff
+ *
+ * buff may be anywhere in memory, including above 1MB
+ */
+Bool fwcfgRead(FwCfgFile* file, Uint32 offset, Uint32 count, void* buff)
+{
+    if (!fwcfgHasDMA || offset > file->size || count > file->size - offset) {
+        return false;
+    }
+
+    Uint32 select = ((Uint32) file->selector << 16) | FW_CFG_DMA_CTL_SELECT;
+
+    if (offset > 0) {
+        // Selecting resets the offset to zero, so select and skip forward in one operation
+        if (!fwcfg_dma(select | FW_CFG_DMA_CTL_SKIP, offset, NULL)) {
+            return false;
+        }
+        select = 0;
+    }
+
+    return fwcfg_dma(select | FW_CFG_DMA_CTL_READ, count, buff);
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * Read count bytes of the item at selector one byte at a time through the data port
+ */
+void fwcfg_readBytes(Uint16 selector, void* buff, Uint32 count)
+{
+    Uint8* bp = buff;
+
+    x86_outw(FW_CFG_PORT_SELECTOR, selector);
+    for (Uint32 ii = 0; ii < count; ++ii) {
+        bp[ii] = x86_inb(FW_CFG_PORT_DATA);
+    }
+}
+
+/*
+ * Run one DMA operation and wait for it to complete
+ *
+ * QEMU completes the transfer before the OUT to the low address port returns,
+ * but the spec asks us to poll the control field until the device clears it
+ */
+Bool fwcfg_dma(Uint32 control, Uint32 length, void* address)
+{
+    volatile FwCfgDmaAccess access;
+
+    access.control = fwcfg_bswap32(control);
+    access.length = fwcfg_bswap32(length);
+    access.address = ((Uint64) fwcfg_bswap32((Uint32) address)) << 32;    // High half is zero
+
+    x86_outl(FW_CFG_PORT_DMA_HIGH, 0);
+    x86_outl(FW_CFG_PORT_DMA_LOW, fwcfg_bswap32((Uint32) &access));
+
+    Uint32 status;
+    while ((status = fwcfg_bswap32(access.control)) & ~FW_CFG_DMA_CTL_ERROR) {
+        ;
+    }
+
+    if (status & FW_CFG_DMA_CTL_ERROR) {
+        LOG_ERROR("fw_cfg: DMA failed, control = %#x, length = %#x\n", control, length);
+        return false;
+    }
+
+    return true;
+}
+
+Uint32 fwcfg_bswap32(Uint32 value)
+{
+    return (value >> 24)
+         | ((value >> 8) & 0x0000FF00)
+         | ((value << 8) & 0x00FF0000)
+         | (value << 24);
+}
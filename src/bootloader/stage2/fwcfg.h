@@ -0,0 +1,12 @@
+#pragma once
+
+#include "stdtypes.h"
+
+typedef struct {
+    Uint16  selector;
+    Uint32  size;
+} FwCfgFile;
+
+Bool fwcfgInitialize();
+Bool fwcfgFindFile(const char* name, FwCfgFile* file);
+Bool fwcfgRead(FwCfgFile* file, Uint32 offset, Uint32 count, void* buff);
@@ -0,0 +1,43 @@
+#pragma once
+#include "stdio.h"
+
+/*
+ * Leveled logging for stage2
+ *
+ * LOG_LEVEL is the lowest level that is compiled in. It is set from LOG_LEVEL in build_scripts/config.mk,
+ * e.g. make LOG_LEVEL=TRACE for a fully traced build, and defaults to INFO
+ *
+ * Calls below the threshold become if (0) printf(...), so the compiler still checks the arguments
+ * but generates no code for them, and no console I/O happens in the paths they were in
+ * Dump helpers that print several lines are called inside if (LOG_ENABLED(level)) for the same effect
+ *
+ *   TRACE      Every step of a hot path: each directory entry compared, each block mapped
+ *   DEBUG      Each file opened, the on-disk structures as they are read
+ *   INFO       What was found and loaded. One line per step of the boot
+ *   WARNING    Something unexpected that we worked around
+ *   ERROR      An operation failed
+ */
+
+#define LOG_LEVEL_TRACE     0
+#define LOG_LEVEL_DEBUG     1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_WARNING   3
+#define LOG_LEVEL_ERROR     4
+#define LOG_LEVEL_NONE      5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+
+#define LOG_ENABLED(level)  (LOG_LEVEL <= (level))
+
+#define LOG_AT(level, ...)  do { if (LOG_ENABLED(level)) { printf(__VA_ARGS__); } } while (0)
+
+#define LOG_TRACE(...)      LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...)      LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)       LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...)    LOG_AT(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...)      LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Run call, typically one of the multi-line dump helpers, only if level is compiled in
+#define LOG_DUMP(level, call) do { if (LOG_ENABLED(level)) { call; } } while (0)
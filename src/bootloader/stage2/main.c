@@ -1,5 +1,6 @@
 #include "stdtypes.h"
 #include "stdio.h"
+#include "log.h"
 #include "x86.h"
 #include "disk.h"
 #include "utility.h"
@@ -8,12 +9,20 @@
 #include "mbr.h"
 #include "alloc.h"
 #include "vfs.h"
+#include "elf.h"
+#include "fwcfg.h"
 
-typedef void (*KernelStart)();
+typedef void (*KernelStart)(Uint16 bootDrive, void* initrdBase, Uint32 initrdSize);
 
 void testContentsLargeFileExt();
 void testSubdirectoryFileExt();
-void loadAndJumpToKernelExt();
+void benchmarkReadExt(const char* path);
+void listDirectory(const char* path);
+void loadAndJumpToKernelExt(Uint16 bootDrive);
+Uint32 loadInitrd(void* base);
+Bool loadKernelFwCfg(void** entry, void** kernelEnd);
+Uint32 loadInitrdFwCfg(void* base);
+Bool readFwCfg(void* source, Uint32 offset, Uint32 count, void* buff);
 void printFileExt(Handle fin);
 int  validateFileExt(Handle fin);
 
@@ -23,10 +32,10 @@ void __attribute__((cdecl)) start(Uint16 bootDrive, void* pt)
 {
     Bool ok;
     clearScreen();
-    printf("Hello from Stage2. Boot drive = %x\n", bootDrive);
+    LOG_INFO("Hello from Stage2. Boot drive = %x\n", bootDrive);
 
     heapInit(HEAP_ADDRESS, HEAP_SIZE);
-    printHeap();
+    LOG_DUMP(LOG_LEVEL_DEBUG, printHeap());
 
    // Copy partition table into a safe, known location
     Partition* pp = (Partition*)pt;
@@ -34,14 +43,17 @@ void __attribute__((cdecl)) start(Uint16 bootDrive, void* pt)
         partitionTable[ii] = *(Partition*) pt;
         pt += sizeof(Partition);
     }
-    printPartitionTable(partitionTable);
+    LOG_DUMP(LOG_LEVEL_DEBUG, printPartitionTable(partitionTable));
 
     vSetType(EXT);
 
     ok = vInitialize(bootDrive, partitionTable);
  
-    testContentsLargeFileExt();
+    //testContentsLargeFileExt();
     //testSubdirectoryFileExt();
+    //benchmarkReadExt("/72MB");
+    //listDirectory("/");
+    loadAndJumpToKernelExt(bootDrive);
 
     panic("Stop in main");
 }
@@ -85,35 +97,196 @@ void testSubdirectoryFileExt()
     vClose(fin);   
 }
 
-void loadAndJumpToKernelExt()
+/*
+ * Read the whole of path sequentially and report the cost per KB for each power of two band of offsets
+ *
+ * The bands line up with the ext2 mapping levels (direct, singly, doubly and triply indirect blocks)
+ * so a deeper level that is slower than the one before it shows up as a jump in cycles per KB
+ */
+void benchmarkReadExt(const char* path)
 {
-    const int BUFF_SIZE = 1024;
-    char buff[BUFF_SIZE];
-   
-    Handle fin = vOpen("/kernel.bin");
+    const Uint32 BUFF_SIZE = 4096;
+    const int BAND_SHIFT_MIN = 16;      // Everything below 64KB is reported as one band
+    Uint8 buff[BUFF_SIZE];
+
+    Handle fin = vOpen(path);
     if (fin == BAD_HANDLE) {
-        panic("Failed to open kernel");
+        printf("benchmarkReadExt: Cannot open '%s'\n", path);
+        return;
     }
 
-    Uint8* kp = KERNEL_LOAD_ADDR;
+    Uint64 size = vGetSize(fin);
+    printf("benchmarkReadExt: '%s', %llu bytes\n", path, size);
+
+    Uint64 position = 0;
+    Uint64 bandEnd = 1ULL << BAND_SHIFT_MIN;
+    Uint64 bandStart = 0;
+    Uint64 bandStartTime = x86_rdtsc();
+    Uint64 startTime = bandStartTime;
     Uint32 count;
+
     while ((count = vRead(fin, BUFF_SIZE, buff)) > 0) {
-        printf("Copying %x bytes from %p to %p\n", count, buff, kp);
-        memcpy(kp, buff, count);
-        kp += count;
+        position += count;
+        if (position >= bandEnd || position == size) {
+            Uint64 now = x86_rdtsc();
+            Uint32 kb = (position - bandStart) >> 10;
+            printf("  %#llx - %#llx: %llu cycles/KB\n", bandStart, position, (now - bandStartTime) / (kb ? kb : 1));
+            bandStart = position;
+            bandStartTime = now;
+            bandEnd <<= 1;
+        }
     }
 
+    Uint64 total = x86_rdtsc() - startTime;
+    printf("benchmarkReadExt: %llu bytes in %llu cycles, %llu cycles/KB\n",
+        position, total, total / ((position >> 10) ? (position >> 10) : 1));
+
     vClose(fin);
+}
+
+/*
+ * Print each entry of the directory at path, fetching a batch of entries per call
+ */
+void listDirectory(const char* path)
+{
+    const Uint32 BATCH_SIZE = 8;
+    VDirEntry entries[BATCH_SIZE];
+
+    Handle dir = vOpen(path);
+    if (dir == BAD_HANDLE) {
+        printf("listDirectory: Cannot open '%s'\n", path);
+        return;
+    }
+
+    Uint32 total = 0;
+    Uint32 count;
+
+    while ((count = vReadDir(dir, entries, BATCH_SIZE)) > 0) {
+        for (Uint32 ii = 0; ii < count; ++ii) {
+            printf("  %c %u %llu %s\n",
+                entries[ii].type == VDIR_TYPE_DIR ? 'd' : '-', entries[ii].id, entries[ii].size, entries[ii].name);
+        }
+        total += count;
+    }
+
+    printf("listDirectory: '%s', %u entries\n", path, total);
+
+    vClose(dir);
+}
+
+void loadAndJumpToKernelExt(Uint16 bootDrive)
+{
+    void* entry;
+    void* kernelEnd;
+
+    // Under QEMU the kernel and initrd may be passed in with -fw_cfg, which is much faster than the disk
+    Bool fwcfg = fwcfgInitialize() && loadKernelFwCfg(&entry, &kernelEnd);
+
+    if (!fwcfg) {
+        Handle fin = vOpen("/kernel.elf");
+        if (fin == BAD_HANDLE) {
+            panic("Failed to open kernel");
+        }
+
+        if (!elfLoadFile(fin, &entry, &kernelEnd)) {
+            panic("Failed to load kernel");
+        }
+
+        vClose(fin);
+    }
 
-    Uint8* pp = KERNEL_LOAD_ADDR;
-    for (int ii = 0; ii < 16; ++ii) {
-        printf("%x ", pp[ii]);
+    void* initrdBase = (void*) align((Uint32) kernelEnd, PAGE_SIZE);
+    Uint32 initrdSize = 0;
+    if (fwcfg) {
+        initrdSize = loadInitrdFwCfg(initrdBase);
     }
-    printf("\n");
+    if (initrdSize == 0) {
+        initrdSize = loadInitrd(initrdBase);
+    }
+    if (initrdSize == 0) {
+        initrdBase = NULL;
+    }
+
+    KernelStart kernelStart = (KernelStart) entry;
+    LOG_INFO("Jumping to kernel at %p\n", kernelStart);
+    kernelStart(bootDrive, initrdBase, initrdSize);
+}
 
-    KernelStart kernelStart = (KernelStart) KERNEL_LOAD_ADDR;
-    printf("Jumping to kernel at %p\n", kernelStart);
-    kernelStart();
+/*
+ * Load /initrd.cpio to base
+ *
+ * The file system copies each block out of its own low memory buffer
+ * so we can read straight into high memory without a bounce buffer
+ *
+ * Returns the size of the ramdisk. Zero if there isn't one
+ */
+Uint32 loadInitrd(void* base)
+{
+    const Uint32 CHUNK_SIZE = 0x10000;
+
+    Handle fin = vOpen("/initrd.cpio");
+    if (fin == BAD_HANDLE) {
+        LOG_INFO("No initrd found\n");
+        return 0;
+    }
+
+    Uint8* ip = base;
+    Uint32 count;
+    while ((count = vRead(fin, CHUNK_SIZE, ip)) > 0) {
+        ip += count;
+    }
+
+    vClose(fin);
+
+    Uint32 size = ip - (Uint8*) base;
+    LOG_INFO("Loaded initrd: %u bytes at %p\n", size, base);
+
+    return size;
+}
+
+/*
+ * Load the kernel from the fw_cfg file opt/myos/kernel.elf
+ *
+ * Returns false if there is no such file, in which case we fall back to the disk
+ */
+Bool loadKernelFwCfg(void** entry, void** kernelEnd)
+{
+    FwCfgFile file;
+    if (!fwcfgFindFile("opt/myos/kernel.elf", &file)) {
+        return false;
+    }
+
+    LOG_INFO("Loading kernel from fw_cfg: %u bytes\n", file.size);
+    if (!elfLoad(readFwCfg, &file, entry, kernelEnd)) {
+        panic("Failed to load kernel from fw_cfg");
+    }
+
+    return true;
+}
+
+/*
+ * Load the fw_cfg file opt/myos/initrd.cpio to base in a single DMA transfer
+ *
+ * Returns the size of the ramdisk. Zero if there isn't one
+ */
+Uint32 loadInitrdFwCfg(void* base)
+{
+    FwCfgFile file;
+    if (!fwcfgFindFile("opt/myos/initrd.cpio", &file) || !fwcfgRead(&file, 0, file.size, base)) {
+        return 0;
+    }
+
+    LOG_INFO("Loaded initrd from fw_cfg: %u bytes at %p\n", file.size, base);
+
+    return file.size;
+}
+
+/*
+ * ElfReader for a fw_cfg file. source is a FwCfgFile
+ */
+Bool readFwCfg(void* source, Uint32 offset, Uint32 count, void* buff)
+{
+    return fwcfgRead((FwCfgFile*) source, offset, count, buff);
 }
 
 /*
@@ -30,7 +30,8 @@
  *   0x000A0000 - 0x000C7FFF - Video
  *   0x000C8000 - 0x000FFFFF - BIOS
  * 
- *   0x00100000 - 0x00110000 - Kernel
+ *   0x00100000 - ...        - Kernel. ELF segments are placed at their physical addresses
+ *   ...                     - Initial ramdisk (initrd.cpio) at the first page boundary after the kernel
  */
 
 #define HEAP_ADDRESS        ((void*) 0x20000)
@@ -45,5 +46,6 @@
 // #define SCRATCH_MEM_ADDRESS ((void*) 0x50000)
 // #define SCRATCH_MEM_SIZE    0x10000
 
-#define KERNEL_LOAD_ADDR    ((void*) 0x100000)
+#define KERNEL_LOAD_ADDR    ((void*) 0x100000)    // Lowest address a kernel segment may be placed at
+#define PAGE_SIZE           0x1000
 
@@ -1,6 +1,7 @@
 #include <stdarg.h>
 #include "stdtypes.h"
 #include "stdio.h"
+#include "format.h"
 #include "x86.h"
 
 const unsigned SCREEN_WIDTH = 80;       // As defined by VGA
@@ -127,152 +128,18 @@ void puts(const char* str)
     }
 }
 
-typedef enum Length {NORMAL, SHORT_SHORT, SHORT, LONG, LONG_LONG} Length;
-const char hex[16] = "0123456789ABCDEF";
-
-void printUnsigned(unsigned long long number, int radix, Bool alt)
+/*
+ * FormatOutput for printf
+ */
+void stdio_formatOutput(char c, void* context)
 {
-    int pos = 0;
-    char buf[32];
-
-    do {
-        Uint32 rem;
-        rem = number % radix;
-        number = number / radix;
-        buf[pos++] =  hex[rem];
-    } while (number > 0);
-
-    if (alt) {
-        if (radix == 16) {
-            buf[pos++] = 'x';
-            buf[pos++] = '0';
-        } else if (radix == 8 && buf[pos-1] != '0') {
-            buf[pos++] = '0';
-        }
-    }
-
-    while (pos-- > 0) {
-        putc(buf[pos]);
-    }
-}
-
-void printSigned(long long number, int radix)
-{
-    if (number < 0) {
-        putc('-');
-        number = -number;
-    }
-
-    printUnsigned(number, radix, false);
+    putc(c);
 }
 
 void printf(const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-
-    Length length = NORMAL;
-    Bool alt = false;
-
-    while (*fmt) {
-        switch (*fmt) {
-        case '%':
-            for (;;) {
-                switch (*++fmt) {
-                case '%':
-                    putc('%');
-                    break;
-                case 'c':
-                    putc(va_arg(args, int)); // Must be an int not a char
-                    break;
-                case 's':
-                    puts(va_arg(args, const char*));
-                    break;
-                case 'd':
-                case 'i':
-                case 'u':
-                case 'X':
-                case 'x':
-                case 'p':
-                case 'o':
-                    Bool sign;
-                    int radix;
-                    switch (*fmt) {
-                    case 'd':   sign =  true; radix = 10; break;
-                    case 'i':   sign =  true; radix = 10; break;
-                    case 'u':   sign = false; radix = 10; break;
-                    case 'X':   sign = false; radix = 16; break;
-                    case 'x':   sign = false; radix = 16; break;
-                    case 'p':   sign = false; radix = 16; break; // In 32 bit mode sizeof(int) == sizeof(int*)
-                    case 'o':   sign = false; radix =  8; break;
-                    }
-                    if (sign) {
-                        switch (length) {
-                        case SHORT_SHORT:
-                        case SHORT:
-                        case NORMAL:
-                            printSigned(va_arg(args, int), radix);
-                            break;
-
-                        case LONG:
-                            printSigned(va_arg(args, long), radix);
-                            break;
-                        
-                        case LONG_LONG:
-                            printSigned(va_arg(args, long long), radix);
-                            break;
-                        }
-                    } else {
-                        switch (length) {
-                        case SHORT_SHORT:
-                        case SHORT:
-                        case NORMAL:
-                            printUnsigned(va_arg(args, unsigned int), radix, alt);
-                            break;
-
-                        case LONG:
-                            printUnsigned(va_arg(args, unsigned long), radix, alt);
-                            break;
-                        
-                        case LONG_LONG:
-                            printUnsigned(va_arg(args, unsigned long long), radix, alt);
-                            break;
-                        }
-                    }
-                    break;
-
-                case 'h':
-                    if (*(fmt+1) == 'h') {
-                        fmt++;
-                        length = SHORT_SHORT;
-                    } else {
-                        length = SHORT;
-                    }
-                    continue;
-                case 'l':
-                    if (*(fmt+1) == 'l') {
-                        fmt++;
-                        length = LONG_LONG;
-                    } else {
-                        length = LONG;
-                    }
-                    continue;
-                
-                case '#':
-                    alt = true;
-                    continue;
-                }
-                length = NORMAL;
-                alt = false;
-                break;
-            }
-            break;
-
-        default:
-            putc(*fmt);
-        }
-        fmt++;
-    }
-
+    vformat(stdio_formatOutput, NULL, fmt, args);
     va_end(args);
 }
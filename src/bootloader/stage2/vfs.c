@@ -8,7 +8,10 @@ typedef struct {
     Bool    (*initialize)(Uint8 driveNumber, Partition* part);
     Handle  (*open)(const char* path);
     Uint32  (*read)(Handle fin, Uint32 count, void* buff);
+    Uint32  (*readAt)(Handle fin, Uint64 offset, Uint32 count, void* buff);
     void    (*close)(Handle handle);
+    Uint64  (*getSize)(Handle handle);
+    Uint32  (*readDir)(Handle handle, VDirEntry* entries, Uint32 maxEntries);
 } Filesystem;
 
 Filesystem filesystems[2] = {
@@ -16,13 +19,19 @@ Filesystem filesystems[2] = {
         fatInitialize,
         fatOpen,
         fatRead,
-        fatClose
+        fatReadAt,
+        fatClose,
+        fatGetSize,
+        fatReadDir
     },
     {
         extInitialize,
         extOpen,
         extRead,
-        extClose
+        extReadAt,
+        extClose,
+        extGetSize,
+        extReadDir
     }
 };
 
@@ -48,7 +57,50 @@ Uint32 vRead(Handle fin, Uint32 count, void* buff)
     return filesystems[vType].read(fin, count, buff);
 }
 
+/*
+ * Read count bytes from offset into buff without moving the handle's position
+ */
+Uint32 vReadAt(Handle fin, Uint64 offset, Uint32 count, void* buff)
+{
+    return filesystems[vType].readAt(fin, offset, count, buff);
+}
+
+/*
+ * Read each of the iovCount pieces described by iov, in order
+ *
+ * Returns the total number of bytes read, stopping after the first piece that comes up short
+ */
+Uint32 vReadv(Handle fin, VIoVec* iov, Uint32 iovCount)
+{
+    Uint32 total = 0;
+
+    for (Uint32 ii = 0; ii < iovCount; ++ii) {
+        Uint32 bytesRead = vReadAt(fin, iov[ii].offset, iov[ii].count, iov[ii].buff);
+        total += bytesRead;
+        if (bytesRead != iov[ii].count) {
+            break;
+        }
+    }
+
+    return total;
+}
+
 void vClose(Handle handle)
 {
     return filesystems[vType].close(handle);
-}
\ No newline at end of file
+}
+
+Uint64 vGetSize(Handle handle)
+{
+    return filesystems[vType].getSize(handle);
+}
+
+/*
+ * Fill entries with up to maxEntries entries of the directory open on handle
+ *
+ * Successive calls continue where the last one stopped. Returns zero at the end of the directory
+ */
+Uint32 vReadDir(Handle handle, VDirEntry* entries, Uint32 maxEntries)
+{
+    return filesystems[vType].readDir(handle, entries, maxEntries);
+}
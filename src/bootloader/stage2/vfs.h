@@ -2,6 +2,7 @@
 
 #include "stdtypes.h"
 #include "ext.h"
+#include "vfstypes.h"
 
 typedef enum {
     FAT = 0,
@@ -12,4 +13,8 @@ void    vSetType(FilesystemType);
 Bool    vInitialize(Uint8 driveNumber, Partition* part);
 Handle  vOpen(const char* path);
 Uint32  vRead(Handle fin, Uint32 count, void* buff);
+Uint32  vReadAt(Handle fin, Uint64 offset, Uint32 count, void* buff);
+Uint32  vReadv(Handle fin, VIoVec* iov, Uint32 iovCount);
 void    vClose(Handle handle);
+Uint64  vGetSize(Handle handle);
+Uint32  vReadDir(Handle handle, VDirEntry* entries, Uint32 maxEntries);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stdtypes.h"
+
+#define VDIR_MAX_NAME_LENGTH    255
+
+typedef enum {
+    VDIR_TYPE_UNKNOWN   = 0,
+    VDIR_TYPE_FILE      = 1,
+    VDIR_TYPE_DIR       = 2,
+    VDIR_TYPE_SYMLINK   = 3,
+    VDIR_TYPE_OTHER     = 4     // Devices, FIFOs and sockets
+} VDirEntryType;
+
+/*
+ * One directory entry as returned by vReadDir, the same whatever the filesystem
+ */
+typedef struct {
+    Uint32      id;                 // Inode number for ext, first cluster for FAT
+    Uint64      size;               // Size in bytes. Zero for FAT directories
+    Uint8       type;               // VDirEntryType
+    Uint8       nameLength;         // Not counting the terminating null
+    char        name[VDIR_MAX_NAME_LENGTH + 1];
+} VDirEntry;
+
+/*
+ * One piece of a vReadv request: count bytes from offset within the file into buff
+ */
+typedef struct {
+    Uint64      offset;
+    Uint32      count;
+    void*       buff;
+} VIoVec;
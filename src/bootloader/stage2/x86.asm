@@ -21,4 +21,41 @@ x86_inb:
     mov dx, [esp + 4]
     xor eax, eax
     in al, dx
-    ret
\ No newline at end of file
+    ret
+
+;
+; x86_outw(Uint16 port, Uint16 value)
+;
+; Output a word value to a port
+;
+global x86_outw
+x86_outw:
+    [bits 32]
+    mov dx, [esp + 4]
+    mov ax, [esp + 8]
+    out dx, ax
+    ret
+
+;
+; x86_outl(Uint16 port, Uint32 value)
+;
+; Output a dword value to a port
+;
+global x86_outl
+x86_outl:
+    [bits 32]
+    mov dx, [esp + 4]
+    mov eax, [esp + 8]
+    out dx, eax
+    ret
+
+;
+; Uint64 x86_rdtsc()
+;
+; Read the time stamp counter. The result is returned in EDX:EAX as cdecl expects for a 64 bit value
+;
+global x86_rdtsc
+x86_rdtsc:
+    [bits 32]
+    rdtsc
+    ret
@@ -4,3 +4,6 @@
 
 void __attribute__((cdecl)) x86_outb(Uint16 port, Uint8 value);
 Uint8 __attribute__((cdecl)) x86_inb(Uint16 port);
+void __attribute__((cdecl)) x86_outw(Uint16 port, Uint16 value);
+void __attribute__((cdecl)) x86_outl(Uint16 port, Uint32 value);
+Uint64 __attribute__((cdecl)) x86_rdtsc();
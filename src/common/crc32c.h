@@ -0,0 +1,19 @@
+#pragma once
+#include "stdtypes.h"
+
+typedef Uint32 (*Crc32cFn)(Uint32 crc, const void* buff, Uint32 count);
+
+Uint32 crc32c(Uint32 crc, const void* buff, Uint32 count);
+
+/*
+ * The implementation crc32c calls. The software version until the kernel binds a better one
+ */
+
+extern Crc32cFn crc32cImpl;
+
+/*
+ * The SSE4.2 version may only be called on a CPU that has SSE4.2
+ */
+
+Uint32 crc32cSoftware(Uint32 crc, const void* buff, Uint32 count);
+Uint32 crc32cSSE42(Uint32 crc, const void* buff, Uint32 count);
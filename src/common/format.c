@@ -0,0 +1,343 @@
+#include "format.h"
+#include "stdtypes.h"
+
+/*
+ * printf style formatting
+ *
+ * vformat does the work and hands each character to an output function, so the same code
+ * prints to the screen or, through vsnprintf, fills a buffer
+ *
+ * Supported: %c %s %d %i %u %x %X %p %o %%, the h, hh, l and ll lengths,
+ * the '#', '0' and '-' flags and a decimal field width
+ *
+ * The i686 has no 64 bit divide, so a 64 bit / or % is a call into libgcc, which is slow
+ * and would be made once per digit. Instead
+ *   hex and octal  Digits are peeled off with shifts and masks
+ *   decimal        Values that fit in 32 bits are divided by 100 with 32 bit arithmetic, which the compiler
+ *                  turns into a multiply by the reciprocal, and each pair of digits comes from a table
+ *                  Bigger values are split into 32 bit chunks of nine digits first, at most two 64 bit divides
+ */
+
+#define MAX_DIGITS          24          // Octal for 64 bits is 22
+#define CHUNK_DIVISOR       1000000000  // Nine decimal digits
+
+typedef enum {NORMAL, SHORT_SHORT, SHORT, LONG, LONG_LONG} Length;
+
+typedef struct {
+    Bool    alt;                // '#'
+    Bool    zeroPad;            // '0'
+    Bool    leftAlign;          // '-'
+    Uint32  width;
+} FormatSpec;
+
+typedef struct {
+    char*   buff;
+    Uint32  size;
+    Uint32  length;             // Characters formatted, including any that didn't fit
+} FormatBuffer;
+
+static const char lowerDigits[16] = "0123456789abcdef";
+static const char upperDigits[16] = "0123456789ABCDEF";
+
+static const char digitPairs[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*
+ * Forward declarations
+ */
+
+int format_unsignedToText(Uint64 number, int radix, Bool upper, char* end);
+int format_decimal32(Uint32 number, char* end);
+void format_number(FormatOutput output, void* context, Uint64 number, Bool negative, int radix, Bool upper, FormatSpec* spec);
+void format_string(FormatOutput output, void* context, const char* str, FormatSpec* spec);
+void format_pad(FormatOutput output, void* context, char c, int count);
+void format_bufferOutput(char c, void* context);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Format fmt and args, passing each resulting character to output along with context
+ */
+void vformat(FormatOutput output, void* context, const char* fmt, va_list args)
+{
+    while (*fmt) {
+        if (*fmt != '%') {
+            output(*fmt++, context);
+            continue;
+        }
+
+        FormatSpec spec = { false, false, false, 0 };
+        Length length = NORMAL;
+
+        // Flags, then the width, then the length
+        for (;; ++fmt) {
+            if (fmt[1] == '#') {
+                spec.alt = true;
+            } else if (fmt[1] == '0') {
+                spec.zeroPad = true;
+            } else if (fmt[1] == '-') {
+                spec.leftAlign = true;
+            } else {
+                break;
+            }
+        }
+        while (fmt[1] >= '0' && fmt[1] <= '9') {
+            spec.width = spec.width * 10 + (*++fmt - '0');
+        }
+        if (fmt[1] == 'h') {
+            ++fmt;
+            length = SHORT;
+            if (fmt[1] == 'h') {
+                ++fmt;
+                length = SHORT_SHORT;
+            }
+        } else if (fmt[1] == 'l') {
+            ++fmt;
+            length = LONG;
+            if (fmt[1] == 'l') {
+                ++fmt;
+                length = LONG_LONG;
+            }
+        }
+
+        switch (*++fmt) {
+        case '%':
+            output('%', context);
+            break;
+
+        case 'c': {
+            char str[2] = { (char) va_arg(args, int), '\0' };   // Must be an int not a char
+            format_string(output, context, str, &spec);
+            break;
+        }
+
+        case 's':
+            format_string(output, context, va_arg(args, const char*), &spec);
+            break;
+
+        case 'd':
+        case 'i': {
+            Int64 number;
+            switch (length) {
+            case SHORT_SHORT:   number = (signed char) va_arg(args, int);   break;
+            case SHORT:         number = (short) va_arg(args, int);         break;
+            case NORMAL:        number = va_arg(args, int);                 break;
+            case LONG:          number = va_arg(args, long);                break;
+            case LONG_LONG:     number = va_arg(args, long long);           break;
+            }
+            // Negate as unsigned so the most negative number doesn't overflow
+            Bool negative = number < 0;
+            format_number(output, context, negative ? -(Uint64) number : (Uint64) number, negative, 10, false, &spec);
+            break;
+        }
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'p':                   // In 32 bit mode sizeof(int) == sizeof(int*)
+        case 'o': {
+            Uint64 number;
+            switch (length) {
+            case SHORT_SHORT:   number = (unsigned char) va_arg(args, unsigned int);    break;
+            case SHORT:         number = (unsigned short) va_arg(args, unsigned int);   break;
+            case NORMAL:        number = va_arg(args, unsigned int);                    break;
+            case LONG:          number = va_arg(args, unsigned long);                   break;
+            case LONG_LONG:     number = va_arg(args, unsigned long long);              break;
+            }
+            int radix = (*fmt == 'u') ? 10 : (*fmt == 'o') ? 8 : 16;
+            format_number(output, context, number, false, radix, *fmt == 'X', &spec);
+            break;
+        }
+
+        case '\0':
+            return;             // A lone % at the end
+
+        default:
+            output(*fmt, context);
+            break;
+        }
+        ++fmt;
+    }
+}
+
+/*
+ * Format into buff, writing at most size characters including the terminating null
+ *
+ * Returns the length of the whole formatted string, which is size or more if it was truncated
+ */
+int vsnprintf(char* buff, Uint32 size, const char* fmt, va_list args)
+{
+    FormatBuffer fb = { buff, size, 0 };
+
+    vformat(format_bufferOutput, &fb, fmt, args);
+
+    if (size > 0) {
+        buff[(fb.length < size) ? fb.length : size - 1] = '\0';
+    }
+
+    return fb.length;
+}
+
+int snprintf(char* buff, Uint32 size, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(buff, size, fmt, args);
+    va_end(args);
+
+    return length;
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * Write the digits of number backwards from end. Returns how many
+ */
+int format_unsignedToText(Uint64 number, int radix, Bool upper, char* end)
+{
+    const char* digits = upper ? upperDigits : lowerDigits;
+    char* p = end;
+
+    if (radix != 10) {
+        int shift = (radix == 16) ? 4 : 3;
+        do {
+            *--p = digits[number & (radix - 1)];
+            number >>= shift;
+        } while (number > 0);
+
+        return end - p;
+    }
+
+    // Nine digit chunks from the bottom, each zero-filled except the leading one
+    while (number > UINT32_MAX) {
+        Uint32 chunk = number % CHUNK_DIVISOR;
+        number /= CHUNK_DIVISOR;
+        int count = format_decimal32(chunk, p);
+        p -= count;
+        for (; count < 9; ++count) {
+            *--p = '0';
+        }
+    }
+
+    p -= format_decimal32((Uint32) number, p);
+
+    return end - p;
+}
+
+/*
+ * Write the decimal digits of number backwards from end, two at a time. Returns how many
+ */
+int format_decimal32(Uint32 number, char* end)
+{
+    char* p = end;
+
+    while (number >= 100) {
+        Uint32 pair = (number % 100) * 2;
+        number /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+
+    if (number >= 10) {
+        *--p = digitPairs[number * 2 + 1];
+        *--p = digitPairs[number * 2];
+    } else {
+        *--p = '0' + number;
+    }
+
+    return end - p;
+}
+
+void format_number(FormatOutput output, void* context, Uint64 number, Bool negative, int radix, Bool upper, FormatSpec* spec)
+{
+    char text[MAX_DIGITS];
+    int count = format_unsignedToText(number, radix, upper, text + MAX_DIGITS);
+    char* digits = text + MAX_DIGITS - count;
+
+    // The sign or prefix, which goes before any zero padding
+    const char* prefix = "";
+    if (negative) {
+        prefix = "-";
+    } else if (spec->alt && radix == 16 && number != 0) {
+        prefix = upper ? "0X" : "0x";
+    } else if (spec->alt && radix == 8 && digits[0] != '0') {
+        prefix = "0";
+    }
+    int prefixLength = 0;
+    while (prefix[prefixLength]) {
+        ++prefixLength;
+    }
+
+    int padding = (int) spec->width - count - prefixLength;
+
+    if (!spec->leftAlign && !spec->zeroPad) {
+        format_pad(output, context, ' ', padding);
+    }
+    for (int ii = 0; ii < prefixLength; ++ii) {
+        output(prefix[ii], context);
+    }
+    if (!spec->leftAlign && spec->zeroPad) {
+        format_pad(output, context, '0', padding);
+    }
+    for (int ii = 0; ii < count; ++ii) {
+        output(digits[ii], context);
+    }
+    if (spec->leftAlign) {
+        format_pad(output, context, ' ', padding);
+    }
+}
+
+void format_string(FormatOutput output, void* context, const char* str, FormatSpec* spec)
+{
+    if (str == NULL) {
+        str = "(null)";
+    }
+
+    int length = 0;
+    while (str[length]) {
+        ++length;
+    }
+
+    if (!spec->leftAlign) {
+        format_pad(output, context, ' ', (int) spec->width - length);
+    }
+    for (int ii = 0; ii < length; ++ii) {
+        output(str[ii], context);
+    }
+    if (spec->leftAlign) {
+        format_pad(output, context, ' ', (int) spec->width - length);
+    }
+}
+
+void format_pad(FormatOutput output, void* context, char c, int count)
+{
+    for (; count > 0; --count) {
+        output(c, context);
+    }
+}
+
+/*
+ * FormatOutput for vsnprintf. Counts everything but only stores what fits, leaving room for the null
+ */
+void format_bufferOutput(char c, void* context)
+{
+    FormatBuffer* fb = (FormatBuffer*) context;
+
+    if (fb->length + 1 < fb->size) {
+        fb->buff[fb->length] = c;
+    }
+    ++fb->length;
+}
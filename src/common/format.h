@@ -0,0 +1,13 @@
+#pragma once
+#include <stdarg.h>
+#include "stdtypes.h"
+
+/*
+ * printf style formatting shared by stage2 and the kernel
+ */
+
+typedef void (*FormatOutput)(char c, void* context);
+
+void vformat(FormatOutput output, void* context, const char* fmt, va_list args);
+int vsnprintf(char* buff, Uint32 size, const char* fmt, va_list args);
+int snprintf(char* buff, Uint32 size, const char* fmt, ...);
@@ -0,0 +1,325 @@
+#include "memory.h"
+#include "stdtypes.h"
+
+/*
+ * Memory primitives shared by stage2 and the kernel
+ *
+ * Copies and fills come in four flavours
+ *   Bytes  One byte per iteration. Simple, and the yardstick for the others
+ *   Rep    rep movsd / rep stosd for the bulk, with rep movsb / rep stosb for the unaligned head and tail
+ *   ERMS   A single rep movsb / rep stosb. Only fast on CPUs with Enhanced REP MOVSB/STOSB,
+ *          whose microcode moves whole cache lines and handles the alignment itself
+ *   SSE2   64 bytes per iteration through the XMM registers. Copies too big to be worth keeping
+ *          in the cache use non-temporal stores, which write around it
+ *
+ * memcpy and memset call through memcpyImpl and memsetImpl, which start out as the Rep versions
+ * They run on any i686 and need no set up, whereas SSE instructions fault until the OS sets CR4.OSFXSR
+ * Once the kernel has probed the CPU it points them at the best version, so the choice is made once
+ * rather than on every call
+ *
+ * The string instructions store through ES:EDI, so ES must hold the flat data segment,
+ * and they count upwards only while the direction flag is clear, as the ABI guarantees on entry
+ */
+
+#define SSE2_BLOCK_SIZE             64
+#define SSE2_NON_TEMPORAL_THRESHOLD 0x40000     // Copies and fills at least this big bypass the cache
+
+typedef Uint32 __attribute__((may_alias)) AliasedUint32;
+
+MemcpyFn memcpyImpl = memcpyRep;
+MemsetFn memsetImpl = memsetRep;
+
+/*
+ * Copy num bytes from src to dst. The regions must not overlap
+ */
+void* memcpy(void* dst, const void* src, Uint32 num)
+{
+    return memcpyImpl(dst, src, num);
+}
+
+/*
+ * Copy num bytes from src to dst. The regions may overlap
+ */
+void* memmove(void* dst, const void* src, Uint32 num)
+{
+    // A forward copy is safe unless dst starts inside src
+    if ((Uint8*) dst <= (const Uint8*) src || (Uint8*) dst >= (const Uint8*) src + num) {
+        return memcpyRep(dst, src, num);
+    }
+
+    // Copy backwards from the last byte: first the odd bytes at the top, then whole dwords
+    Uint8* d = (Uint8*) dst + num - 1;
+    const Uint8* s = (const Uint8*) src + num - 1;
+    Uint32 tail = num & 3;
+    Uint32 dwords = num >> 2;
+
+    __asm__ __volatile__ (
+        "std\n\t"
+        "rep movsb\n\t"
+        "sub $3, %%esi\n\t"         // Point at the start of the last whole dword
+        "sub $3, %%edi\n\t"
+        "mov %3, %%ecx\n\t"
+        "rep movsl\n\t"
+        "cld"
+        : "+D" (d), "+S" (s), "+c" (tail)
+        : "r" (dwords)
+        : "memory");
+
+    return dst;
+}
+
+/*
+ * Set num bytes at ptr to value, which is used as an unsigned char
+ */
+void* memset(void* ptr, int value, Uint32 num)
+{
+    return memsetImpl(ptr, value, num);
+}
+
+/*
+ * Compare num bytes. Returns zero if they match, otherwise the difference of the first bytes to differ
+ */
+int memcmp(const void* ptr1, const void* ptr2, Uint32 num)
+{
+    const Uint8* u8Ptr1 = (const Uint8*) ptr1;
+    const Uint8* u8Ptr2 = (const Uint8*) ptr2;
+
+    // Skip matching dwords, then find the byte that differs
+    while (num >= 4 && *(const AliasedUint32*) u8Ptr1 == *(const AliasedUint32*) u8Ptr2) {
+        u8Ptr1 += 4;
+        u8Ptr2 += 4;
+        num -= 4;
+    }
+
+    for (; num > 0; --num, ++u8Ptr1, ++u8Ptr2) {
+        if (*u8Ptr1 != *u8Ptr2) {
+            return *u8Ptr1 - *u8Ptr2;
+        }
+    }
+
+    return 0;
+}
+
+// ###############################################
+//      Implementations
+// ###############################################
+
+/*
+ * The byte loops must not be turned back into calls to memcpy and memset by the optimizer
+ */
+void* __attribute__((optimize("no-tree-loop-distribute-patterns"))) memcpyBytes(void* dst, const void* src, Uint32 num)
+{
+    Uint8* u8Dst       = (Uint8 *) dst;
+    const Uint8* u8Src = (const Uint8 *) src;
+
+    for (Uint32 ii = 0; ii < num; ++ii) {
+        u8Dst[ii] = u8Src[ii];
+    }
+
+    return dst;
+}
+
+void* __attribute__((optimize("no-tree-loop-distribute-patterns"))) memsetBytes(void* ptr, int value, Uint32 num)
+{
+    Uint8* u8Ptr = (Uint8 *)ptr;
+
+    for (Uint32 ii = 0; ii < num; ++ii) {
+        u8Ptr[ii] = (Uint8) value;      // In real C, this is what happens. Passed as int, but used as unsigned char
+    }
+
+    return ptr;
+}
+
+/*
+ * Copy bytes up to a dword aligned destination, then dwords, then the remaining bytes
+ */
+void* memcpyRep(void* dst, const void* src, Uint32 num)
+{
+    void* d = dst;
+    Uint32 head = (-(Uint32) dst) & 3;
+    if (head > num) {
+        head = num;
+    }
+    Uint32 dwords = (num - head) >> 2;
+    Uint32 tail = (num - head) & 3;
+
+    __asm__ __volatile__ (
+        "rep movsb\n\t"
+        "mov %3, %%ecx\n\t"
+        "rep movsl\n\t"
+        "mov %4, %%ecx\n\t"
+        "rep movsb"
+        : "+D" (d), "+S" (src), "+c" (head)
+        : "r" (dwords), "r" (tail)
+        : "memory");
+
+    return dst;
+}
+
+void* memsetRep(void* ptr, int value, Uint32 num)
+{
+    void* d = ptr;
+    Uint32 pattern = (Uint8) value * 0x01010101;
+    Uint32 head = (-(Uint32) ptr) & 3;
+    if (head > num) {
+        head = num;
+    }
+    Uint32 dwords = (num - head) >> 2;
+    Uint32 tail = (num - head) & 3;
+
+    __asm__ __volatile__ (
+        "rep stosb\n\t"
+        "mov %3, %%ecx\n\t"
+        "rep stosl\n\t"
+        "mov %4, %%ecx\n\t"
+        "rep stosb"
+        : "+D" (d), "+c" (head)
+        : "a" (pattern), "r" (dwords), "r" (tail)
+        : "memory");
+
+    return ptr;
+}
+
+void* memcpyERMS(void* dst, const void* src, Uint32 num)
+{
+    void* d = dst;
+
+    __asm__ __volatile__ (
+        "rep movsb"
+        : "+D" (d), "+S" (src), "+c" (num)
+        :
+        : "memory");
+
+    return dst;
+}
+
+void* memsetERMS(void* ptr, int value, Uint32 num)
+{
+    void* d = ptr;
+
+    __asm__ __volatile__ (
+        "rep stosb"
+        : "+D" (d), "+c" (num)
+        : "a" (value)
+        : "memory");
+
+    return ptr;
+}
+
+/*
+ * Copy up to a 16 byte aligned destination with memcpyRep, then 64 bytes at a time, then the rest
+ *
+ * The source may be unaligned so it is loaded with movdqu. Stores are aligned
+ */
+void* __attribute__((target("sse2"))) memcpySSE2(void* dst, const void* src, Uint32 num)
+{
+    Uint8* d = (Uint8*) dst;
+    const Uint8* s = (const Uint8*) src;
+
+    Uint32 head = (-(Uint32) d) & 15;
+    if (head > num) {
+        head = num;
+    }
+    memcpyRep(d, s, head);
+    d += head;
+    s += head;
+    num -= head;
+
+    Uint32 blocks = num / SSE2_BLOCK_SIZE;
+    Uint32 tail = num % SSE2_BLOCK_SIZE;
+
+    if (blocks > 0 && num >= SSE2_NON_TEMPORAL_THRESHOLD) {
+        __asm__ __volatile__ (
+            "1:\n\t"
+            "movdqu   (%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movntdq %%xmm0,   (%0)\n\t"
+            "movntdq %%xmm1, 16(%0)\n\t"
+            "movntdq %%xmm2, 32(%0)\n\t"
+            "movntdq %%xmm3, 48(%0)\n\t"
+            "add $64, %1\n\t"
+            "add $64, %0\n\t"
+            "dec %2\n\t"
+            "jnz 1b\n\t"
+            "sfence"                        // Non-temporal stores are weakly ordered
+            : "+r" (d), "+r" (s), "+r" (blocks)
+            :
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    } else if (blocks > 0) {
+        __asm__ __volatile__ (
+            "1:\n\t"
+            "movdqu   (%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movdqa %%xmm0,   (%0)\n\t"
+            "movdqa %%xmm1, 16(%0)\n\t"
+            "movdqa %%xmm2, 32(%0)\n\t"
+            "movdqa %%xmm3, 48(%0)\n\t"
+            "add $64, %1\n\t"
+            "add $64, %0\n\t"
+            "dec %2\n\t"
+            "jnz 1b"
+            : "+r" (d), "+r" (s), "+r" (blocks)
+            :
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+
+    memcpyRep(d, s, tail);
+
+    return dst;
+}
+
+void* __attribute__((target("sse2"))) memsetSSE2(void* ptr, int value, Uint32 num)
+{
+    Uint8* d = (Uint8*) ptr;
+
+    Uint32 head = (-(Uint32) d) & 15;
+    if (head > num) {
+        head = num;
+    }
+    memsetRep(d, value, head);
+    d += head;
+    num -= head;
+
+    Uint32 blocks = num / SSE2_BLOCK_SIZE;
+    Uint32 tail = num % SSE2_BLOCK_SIZE;
+    Uint32 pattern = (Uint8) value * 0x01010101;
+
+    if (blocks > 0) {
+        Bool nonTemporal = num >= SSE2_NON_TEMPORAL_THRESHOLD;
+        __asm__ __volatile__ (
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n\t"     // Copy the pattern to all four dwords
+            "test %3, %3\n\t"
+            "jnz 2f\n\t"
+            "1:\n\t"
+            "movdqa %%xmm0,   (%0)\n\t"
+            "movdqa %%xmm0, 16(%0)\n\t"
+            "movdqa %%xmm0, 32(%0)\n\t"
+            "movdqa %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b\n\t"
+            "jmp 3f\n\t"
+            "2:\n\t"
+            "movntdq %%xmm0,   (%0)\n\t"
+            "movntdq %%xmm0, 16(%0)\n\t"
+            "movntdq %%xmm0, 32(%0)\n\t"
+            "movntdq %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 2b\n\t"
+            "sfence\n\t"
+            "3:"
+            : "+r" (d), "+r" (blocks)
+            : "r" (pattern), "r" ((Uint32) nonTemporal)
+            : "memory", "xmm0");
+    }
+
+    memsetRep(d, value, tail);
+
+    return ptr;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "stdtypes.h"
+
+/*
+ * Memory primitives shared by stage2 and the kernel
+ */
+
+void* memcpy(void* dst, const void* src, Uint32 num);
+void* memmove(void* dst, const void* src, Uint32 num);
+void* memset(void* ptr, int value, Uint32 num);
+int memcmp(const void* ptr1, const void* ptr2, Uint32 num);
+
+typedef void* (*MemcpyFn)(void* dst, const void* src, Uint32 num);
+typedef void* (*MemsetFn)(void* ptr, int value, Uint32 num);
+
+/*
+ * The implementations memcpy and memset call. The Rep versions until the kernel binds better ones
+ */
+
+extern MemcpyFn memcpyImpl;
+extern MemsetFn memsetImpl;
+
+/*
+ * The individual implementations behind memcpy and memset, so they can be compared
+ * The ERMS versions are correct everywhere but only fast on CPUs with Enhanced REP MOVSB/STOSB
+ * The SSE2 versions may only be called once SSE is enabled on a CPU that has SSE2
+ */
+
+void* memcpyBytes(void* dst, const void* src, Uint32 num);
+void* memcpyRep(void* dst, const void* src, Uint32 num);
+void* memcpyERMS(void* dst, const void* src, Uint32 num);
+void* memcpySSE2(void* dst, const void* src, Uint32 num);
+
+void* memsetBytes(void* ptr, int value, Uint32 num);
+void* memsetRep(void* ptr, int value, Uint32 num);
+void* memsetERMS(void* ptr, int value, Uint32 num);
+void* memsetSSE2(void* ptr, int value, Uint32 num);
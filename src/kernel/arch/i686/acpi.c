@@ -0,0 +1,138 @@
+#include "acpi.h"
+#include "stdtypes.h"
+#include "string.h"
+
+/*
+ * Just enough ACPI to find the tables the firmware left in memory
+ *
+ * https://uefi.org/specs/ACPI/6.5/05_ACPI_Software_Programming_Model.html
+ * https://wiki.osdev.org/RSDP
+ *
+ * The Root System Description Pointer is on a 16 byte boundary in the first KB of the
+ * Extended BIOS Data Area or in the BIOS ROM between 0xE0000 and 0xFFFFF
+ * It points to the Root System Description Table, which is a header followed by
+ * the 32 bit physical addresses of the other tables
+ *
+ * ACPI 2.0 adds the XSDT with 64 bit addresses, but the RSDT is still there and
+ * a 32 bit kernel can't reach anything the XSDT could add
+ *
+ * The kernel runs without paging, so the tables are read where they are
+ */
+
+#define RSDP_SIGNATURE          "RSD PTR "
+#define RSDP_V1_SIZE            20
+#define EBDA_SEGMENT_POINTER    ((const Uint16*) 0x40E)
+#define EBDA_SEARCH_SIZE        0x400
+#define BIOS_ROM_START          0xE0000
+#define BIOS_ROM_END            0x100000
+
+typedef struct {
+    char    signature[8];       // "RSD PTR "
+    Uint8   checksum;           // The first 20 bytes sum to zero
+    char    oemId[6];
+    Uint8   revision;           // 0 for ACPI 1.0, 2 for 2.0 and later
+    Uint32  rsdtAddress;
+} __attribute__((packed)) RSDP;
+
+typedef struct {
+    ACPITableHeader header;
+    Uint32          tables[];
+} __attribute__((packed)) RSDT;
+
+struct {
+    const RSDT* rsdt;
+    Uint32      tableCount;
+} acpi;
+
+/*
+ * Forward declarations
+ */
+
+const RSDP* acpi_findRSDP();
+const RSDP* acpi_scanRSDP(Uint32 start, Uint32 end);
+Bool acpi_checksum(const void* data, Uint32 length);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Locate the RSDT. Returns false if there is no valid ACPI
+ */
+Bool acpiInitialize()
+{
+    const RSDP* rsdp = acpi_findRSDP();
+    if (rsdp == NULL) {
+        return false;
+    }
+
+    const RSDT* rsdt = (const RSDT*) rsdp->rsdtAddress;
+    if (memcmp(rsdt->header.signature, "RSDT", 4) != 0 || !acpi_checksum(rsdt, rsdt->header.length)) {
+        return false;
+    }
+
+    acpi.rsdt = rsdt;
+    acpi.tableCount = (rsdt->header.length - sizeof(ACPITableHeader)) / sizeof(Uint32);
+
+    return true;
+}
+
+/*
+ * The first table with the given 4 character signature, e.g. "APIC" for the MADT
+ *
+ * Returns NULL if there is no such table, its checksum is bad, or acpiInitialize failed
+ */
+const ACPITableHeader* acpiFindTable(const char* signature)
+{
+    for (Uint32 ii = 0; ii < acpi.tableCount; ++ii) {
+        const ACPITableHeader* table = (const ACPITableHeader*) acpi.rsdt->tables[ii];
+        if (memcmp(table->signature, signature, 4) == 0 && acpi_checksum(table, table->length)) {
+            return table;
+        }
+    }
+
+    return NULL;
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+const RSDP* acpi_findRSDP()
+{
+    Uint32 ebda = (Uint32) *EBDA_SEGMENT_POINTER << 4;
+
+    const RSDP* rsdp = NULL;
+    if (ebda != 0) {
+        rsdp = acpi_scanRSDP(ebda, ebda + EBDA_SEARCH_SIZE);
+    }
+    if (rsdp == NULL) {
+        rsdp = acpi_scanRSDP(BIOS_ROM_START, BIOS_ROM_END);
+    }
+
+    return rsdp;
+}
+
+const RSDP* acpi_scanRSDP(Uint32 start, Uint32 end)
+{
+    for (Uint32 address = start; address < end; address += 16) {
+        const RSDP* rsdp = (const RSDP*) address;
+        if (memcmp(rsdp->signature, RSDP_SIGNATURE, 8) == 0 && acpi_checksum(rsdp, RSDP_V1_SIZE)) {
+            return rsdp;
+        }
+    }
+
+    return NULL;
+}
+
+Bool acpi_checksum(const void* data, Uint32 length)
+{
+    const Uint8* bytes = data;
+    Uint8 sum = 0;
+
+    for (Uint32 ii = 0; ii < length; ++ii) {
+        sum += bytes[ii];
+    }
+
+    return sum == 0;
+}
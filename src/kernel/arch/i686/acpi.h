@@ -0,0 +1,21 @@
+#pragma once
+
+#include "stdtypes.h"
+
+/*
+ * The header every ACPI System Description Table starts with
+ */
+typedef struct {
+    char    signature[4];
+    Uint32  length;             // Of the whole table, header included
+    Uint8   revision;
+    Uint8   checksum;           // All length bytes sum to zero
+    char    oemId[6];
+    char    oemTableId[8];
+    Uint32  oemRevision;
+    Uint32  creatorId;
+    Uint32  creatorRevision;
+} __attribute__((packed)) ACPITableHeader;
+
+Bool acpiInitialize();
+const ACPITableHeader* acpiFindTable(const char* signature);
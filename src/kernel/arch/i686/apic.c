@@ -0,0 +1,354 @@
+#include "apic.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "isr.h"
+
+/*
+ * Local APIC and I/O APIC
+ *
+ * https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sdm.html (Vol 3A, chapter 11)
+ * https://pdos.csail.mit.edu/6.828/2016/readings/ia32/ioapic.pdf
+ * https://wiki.osdev.org/APIC
+ * https://wiki.osdev.org/MADT
+ *
+ * Each CPU has a local APIC that delivers interrupts to it, and the I/O APICs route the
+ * interrupt lines from devices to the local APICs. Both are programmed through memory mapped registers,
+ * so masking an IRQ or ending an interrupt is a single store rather than a series of slow port writes
+ *
+ * The ACPI MADT (signature "APIC") lists the local APIC address, a processor entry for each CPU,
+ * each I/O APIC with the first Global System Interrupt (GSI) it handles, and the overrides
+ * for ISA IRQs that aren't wired to the GSI of the same number. Under QEMU the PIT's IRQ0 arrives on GSI 2
+ *
+ * We route the 16 ISA IRQs to the boot CPU on baseVector + irq, the same vectors the PIC used,
+ * so everything above the interrupt controller is the same in either mode
+ * Each redirection entry starts masked and is unmasked when a driver registers a handler
+ */
+
+#define MADT_ENTRY_LOCAL_APIC           0
+#define MADT_ENTRY_IO_APIC              1
+#define MADT_ENTRY_SOURCE_OVERRIDE      2
+
+#define MADT_LOCAL_APIC_ENABLED         0x01
+
+#define MPS_POLARITY_MASK               0x03
+#define MPS_POLARITY_ACTIVE_LOW         0x03
+#define MPS_TRIGGER_MASK                0x0C
+#define MPS_TRIGGER_LEVEL               0x0C
+
+// Local APIC registers, as offsets in Uint32s from the base
+#define LAPIC_ID                        (0x020 / 4)
+#define LAPIC_VERSION                   (0x030 / 4)
+#define LAPIC_TASK_PRIORITY             (0x080 / 4)
+#define LAPIC_EOI                       (0x0B0 / 4)
+#define LAPIC_SPURIOUS                  (0x0F0 / 4)
+#define LAPIC_IRR                       (0x200 / 4)     // Eight registers, 16 bytes apart, 32 vectors each
+
+#define LAPIC_SPURIOUS_ENABLE           0x100
+
+// I/O APIC registers, reached through the select and window registers
+#define IOAPIC_SELECT                   (0x00 / 4)
+#define IOAPIC_WINDOW                   (0x10 / 4)
+
+#define IOAPIC_REG_ID                   0x00
+#define IOAPIC_REG_VERSION              0x01
+#define IOAPIC_REG_REDIRECTION          0x10    // Two registers, low then high, for each pin
+
+#define IOAPIC_REDIRECTION_MASKED       (1 << 16)
+#define IOAPIC_REDIRECTION_LEVEL        (1 << 15)
+#define IOAPIC_REDIRECTION_ACTIVE_LOW   (1 << 13)
+
+#define NO_GSI                          0xFFFFFFFF
+
+typedef struct {
+    ACPITableHeader header;
+    Uint32  localApicAddress;
+    Uint32  flags;
+    Uint8   entries[];
+} __attribute__((packed)) MADT;
+
+typedef struct {
+    Uint8   type;
+    Uint8   length;
+} __attribute__((packed)) MADTEntry;
+
+typedef struct {
+    MADTEntry entry;
+    Uint8   processorId;
+    Uint8   apicId;
+    Uint32  flags;
+} __attribute__((packed)) MADTLocalAPIC;
+
+typedef struct {
+    MADTEntry entry;
+    Uint8   ioApicId;
+    Uint8   reserved;
+    Uint32  address;
+    Uint32  gsiBase;
+} __attribute__((packed)) MADTIOAPIC;
+
+typedef struct {
+    MADTEntry entry;
+    Uint8   bus;                // 0 = ISA
+    Uint8   source;             // ISA IRQ
+    Uint32  gsi;
+    Uint16  flags;              // MPS INTI flags: polarity and trigger mode
+} __attribute__((packed)) MADTSourceOverride;
+
+typedef struct {
+    volatile Uint32* base;
+    Uint8   id;
+    Uint32  gsiBase;
+    Uint32  pinCount;
+} IOAPIC;
+
+struct {
+    volatile Uint32* lapic;
+    Uint8   bootApicId;
+    Uint32  cpuCount;
+    Uint8   cpuApicIds[APIC_MAX_CPUS];
+    Uint32  ioapicCount;
+    IOAPIC  ioapics[APIC_MAX_IOAPICS];
+    Uint32  isaGSI[APIC_NUM_ISA_IRQS];      // NO_GSI if another IRQ took over its GSI
+    Uint16  isaFlags[APIC_NUM_ISA_IRQS];
+} apic;
+
+volatile Uint32* apicEOIRegister = NULL;
+
+/*
+ * Forward declarations
+ */
+
+Bool apic_parseMADT(const MADT* madt);
+IOAPIC* apic_findIOAPIC(Uint32 gsi);
+Uint32 apic_readIOAPIC(IOAPIC* ioapic, Uint32 reg);
+void apic_writeIOAPIC(IOAPIC* ioapic, Uint32 reg, Uint32 value);
+void apic_setMasked(int irq, Bool masked);
+void apic_spuriousHandler(ISRRegisters* regs);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Find the APICs in the MADT, enable the boot CPU's local APIC and route the ISA IRQs to it, masked
+ *
+ * Returns false, having changed nothing, if there is no local APIC, no MADT or no I/O APIC
+ * Interrupts must be disabled
+ */
+Bool apicInitialize(Uint8 baseVector)
+{
+    if (!cpuFeatures.apic || !acpiInitialize()) {
+        return false;
+    }
+
+    const MADT* madt = (const MADT*) acpiFindTable("APIC");
+    if (madt == NULL || !apic_parseMADT(madt)) {
+        return false;
+    }
+
+    // The local APIC sends the spurious vector, without needing an EOI, when an interrupt it
+    // was about to deliver goes away. Nothing to do but ignore it
+    isrRegisterHandler(APIC_SPURIOUS_VECTOR, apic_spuriousHandler);
+
+    apic.lapic[LAPIC_TASK_PRIORITY] = 0;
+    apic.lapic[LAPIC_SPURIOUS] = LAPIC_SPURIOUS_ENABLE | APIC_SPURIOUS_VECTOR;
+    apic.bootApicId = apic.lapic[LAPIC_ID] >> 24;
+
+    // Mask every pin, then point the ISA IRQs at the boot CPU
+    for (Uint32 ii = 0; ii < apic.ioapicCount; ++ii) {
+        IOAPIC* ioapic = &apic.ioapics[ii];
+        for (Uint32 pin = 0; pin < ioapic->pinCount; ++pin) {
+            apic_writeIOAPIC(ioapic, IOAPIC_REG_REDIRECTION + pin * 2, IOAPIC_REDIRECTION_MASKED);
+        }
+    }
+
+    for (int irq = 0; irq < APIC_NUM_ISA_IRQS; ++irq) {
+        IOAPIC* ioapic = apic_findIOAPIC(apic.isaGSI[irq]);
+        if (ioapic == NULL) {
+            continue;
+        }
+
+        Uint32 pin = apic.isaGSI[irq] - ioapic->gsiBase;
+        Uint32 low = IOAPIC_REDIRECTION_MASKED | (baseVector + irq);    // Fixed delivery, physical destination
+        if ((apic.isaFlags[irq] & MPS_POLARITY_MASK) == MPS_POLARITY_ACTIVE_LOW) {
+            low |= IOAPIC_REDIRECTION_ACTIVE_LOW;
+        }
+        if ((apic.isaFlags[irq] & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL) {
+            low |= IOAPIC_REDIRECTION_LEVEL;
+        }
+
+        apic_writeIOAPIC(ioapic, IOAPIC_REG_REDIRECTION + pin * 2 + 1, (Uint32) apic.bootApicId << 24);
+        apic_writeIOAPIC(ioapic, IOAPIC_REG_REDIRECTION + pin * 2, low);
+    }
+
+    apicEOIRegister = &apic.lapic[LAPIC_EOI];
+
+    return true;
+}
+
+void apicMask(int irq)
+{
+    apic_setMasked(irq, true);
+}
+
+void apicUnmask(int irq)
+{
+    apic_setMasked(irq, false);
+}
+
+/*
+ * Whether the local APIC has accepted vector and not yet delivered it to the CPU
+ */
+Bool apicIsPending(Uint8 vector)
+{
+    return (apic.lapic[LAPIC_IRR + (vector / 32) * 4] & (1 << (vector % 32))) != 0;
+}
+
+void apicEndOfInterrupt()
+{
+    *apicEOIRegister = 0;
+}
+
+void apicPrint()
+{
+    if (apicEOIRegister == NULL) {
+        printf("APIC: not in use, interrupts through the 8259 PIC\n");
+        return;
+    }
+
+    printf("APIC: local APIC at %p, boot CPU APIC ID %u, %u CPUs:", apic.lapic, apic.bootApicId, apic.cpuCount);
+    for (Uint32 ii = 0; ii < apic.cpuCount; ++ii) {
+        printf(" %u", apic.cpuApicIds[ii]);
+    }
+    printf("\n");
+
+    for (Uint32 ii = 0; ii < apic.ioapicCount; ++ii) {
+        IOAPIC* ioapic = &apic.ioapics[ii];
+        printf("  I/O APIC %u at %p: GSIs %u - %u\n",
+            ioapic->id, ioapic->base, ioapic->gsiBase, ioapic->gsiBase + ioapic->pinCount - 1);
+    }
+
+    for (int irq = 0; irq < APIC_NUM_ISA_IRQS; ++irq) {
+        if (apic.isaGSI[irq] != irq || apic.isaFlags[irq] != 0) {
+            printf("  IRQ %d -> GSI %d, flags %x\n", irq, apic.isaGSI[irq], apic.isaFlags[irq]);
+        }
+    }
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+Bool apic_parseMADT(const MADT* madt)
+{
+    apic.lapic = (volatile Uint32*) madt->localApicAddress;
+
+    for (int irq = 0; irq < APIC_NUM_ISA_IRQS; ++irq) {
+        apic.isaGSI[irq] = irq;
+        apic.isaFlags[irq] = 0;     // Bus default: ISA is edge triggered, active high
+    }
+
+    const Uint8* end = (const Uint8*) madt + madt->header.length;
+    const Uint8* ep = madt->entries;
+
+    while (ep + sizeof(MADTEntry) <= end) {
+        const MADTEntry* entry = (const MADTEntry*) ep;
+        if (entry->length < sizeof(MADTEntry) || ep + entry->length > end) {
+            break;
+        }
+
+        switch (entry->type) {
+        case MADT_ENTRY_LOCAL_APIC: {
+            const MADTLocalAPIC* lapic = (const MADTLocalAPIC*) entry;
+            if ((lapic->flags & MADT_LOCAL_APIC_ENABLED) && apic.cpuCount < APIC_MAX_CPUS) {
+                apic.cpuApicIds[apic.cpuCount++] = lapic->apicId;
+            }
+            break;
+        }
+
+        case MADT_ENTRY_IO_APIC: {
+            const MADTIOAPIC* madtIOAPIC = (const MADTIOAPIC*) entry;
+            if (apic.ioapicCount < APIC_MAX_IOAPICS) {
+                IOAPIC* ioapic = &apic.ioapics[apic.ioapicCount++];
+                ioapic->base = (volatile Uint32*) madtIOAPIC->address;
+                ioapic->id = madtIOAPIC->ioApicId;
+                ioapic->gsiBase = madtIOAPIC->gsiBase;
+                ioapic->pinCount = ((apic_readIOAPIC(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+            }
+            break;
+        }
+
+        case MADT_ENTRY_SOURCE_OVERRIDE: {
+            const MADTSourceOverride* override = (const MADTSourceOverride*) entry;
+            if (override->bus != 0 || override->source >= APIC_NUM_ISA_IRQS) {
+                break;
+            }
+            // Whichever IRQ was identity mapped to this GSI isn't wired to it, e.g. IRQ2 the PIC cascade
+            for (int irq = 0; irq < APIC_NUM_ISA_IRQS; ++irq) {
+                if (apic.isaGSI[irq] == override->gsi) {
+                    apic.isaGSI[irq] = NO_GSI;
+                }
+            }
+            apic.isaGSI[override->source] = override->gsi;
+            apic.isaFlags[override->source] = override->flags;
+            break;
+        }
+        }
+
+        ep += entry->length;
+    }
+
+    return apic.ioapicCount > 0;
+}
+
+IOAPIC* apic_findIOAPIC(Uint32 gsi)
+{
+    for (Uint32 ii = 0; ii < apic.ioapicCount; ++ii) {
+        IOAPIC* ioapic = &apic.ioapics[ii];
+        if (gsi >= ioapic->gsiBase && gsi < ioapic->gsiBase + ioapic->pinCount) {
+            return ioapic;
+        }
+    }
+
+    return NULL;
+}
+
+Uint32 apic_readIOAPIC(IOAPIC* ioapic, Uint32 reg)
+{
+    ioapic->base[IOAPIC_SELECT] = reg;
+    return ioapic->base[IOAPIC_WINDOW];
+}
+
+void apic_writeIOAPIC(IOAPIC* ioapic, Uint32 reg, Uint32 value)
+{
+    ioapic->base[IOAPIC_SELECT] = reg;
+    ioapic->base[IOAPIC_WINDOW] = value;
+}
+
+/*
+ * Set or clear the mask bit in the IRQ's redirection entry, keeping the rest of it
+ */
+void apic_setMasked(int irq, Bool masked)
+{
+    IOAPIC* ioapic = apic_findIOAPIC(apic.isaGSI[irq]);
+    if (ioapic == NULL) {
+        return;
+    }
+
+    Uint32 reg = IOAPIC_REG_REDIRECTION + (apic.isaGSI[irq] - ioapic->gsiBase) * 2;
+    Uint32 low = apic_readIOAPIC(ioapic, reg);
+
+    if (masked) {
+        low |= IOAPIC_REDIRECTION_MASKED;
+    } else {
+        low &= ~IOAPIC_REDIRECTION_MASKED;
+    }
+
+    apic_writeIOAPIC(ioapic, reg, low);
+}
+
+void apic_spuriousHandler(ISRRegisters* regs)
+{
+}
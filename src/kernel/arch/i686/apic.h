@@ -0,0 +1,21 @@
+#pragma once
+
+#include "stdtypes.h"
+
+#define APIC_SPURIOUS_VECTOR    0xFF
+#define APIC_MAX_CPUS           16
+#define APIC_MAX_IOAPICS        4
+#define APIC_NUM_ISA_IRQS       16
+
+Bool apicInitialize(Uint8 baseVector);
+void apicMask(int irq);
+void apicUnmask(int irq);
+void apicEndOfInterrupt();
+Bool apicIsPending(Uint8 vector);
+void apicPrint();
+
+/*
+ * The local APIC's EOI register. irq.asm writes zero to it to end an interrupt
+ * NULL until apicInitialize succeeds
+ */
+extern volatile Uint32* apicEOIRegister;
@@ -0,0 +1,179 @@
+#include "clock.h"
+#include "stdtypes.h"
+#include "io.h"
+#include "irq.h"
+
+/*
+ * The clock source: a 64 bit count that only goes up, and the rate at which it does so
+ *
+ * https://wiki.osdev.org/Programmable_Interval_Timer
+ *
+ * Every PC has the 8253/8254 Programmable Interval Timer (PIT), whose counters run at 1.193182MHz
+ * We put channel 0 in mode 2 (rate generator) with the largest reload value, so its counter
+ * counts down by one per tick from 65536 to 1, raises IRQ0 and starts again, about 18.2 times a second
+ * That is the same IRQ0 rate the BIOS leaves behind, but unlike the BIOS's mode 3
+ * the counter can be read back as a plain count of elapsed ticks
+ *
+ * The counter only says how far we are into the current 55ms period, so IRQ0 calls clockTick
+ * to add a whole period to the count each time it wraps. A wrap whose IRQ0 hasn't been taken yet,
+ * because interrupts are off, is seen as IRQ0 pending and added on when reading
+ * If interrupts are off for more than a whole period, the periods in between are lost
+ *
+ * Reading the PIT takes three slow port accesses, so if the CPU has a TSC that ticks at a constant rate
+ * we use that instead, having first measured its frequency against the PIT
+ */
+
+#define PIT_FREQUENCY               1193182
+#define PIT_CHANNEL0_DATA_PORT      0x40
+#define PIT_COMMAND_PORT            0x43
+
+#define PIT_CHANNEL0_LOHI_MODE2     0x34    // Channel 0, low then high byte, mode 2, binary
+#define PIT_CHANNEL0_LATCH          0x00    // Channel 0, latch count
+
+#define PIT_PERIOD                  65536   // Ticks per wrap of the counter, and so per IRQ0
+#define CALIBRATION_TICKS           (PIT_FREQUENCY / 20)    // 50ms
+
+typedef struct {
+    Uint64 frequency;
+    Uint64 pitTicks;        // PIT ticks at the start of the current period. Advanced by clockTick
+    Uint64 lastRead;        // What clock_readPIT last returned
+} Clock;
+
+static Clock clock;
+
+/*
+ * Forward declarations
+ */
+
+Uint64 clock_readPIT();
+Uint64 clock_readTSC();
+Uint16 clock_readPITCounter();
+Uint64 clock_calibrateTSC();
+
+ClockFn clockImpl = clock_readPIT;
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Start the PIT and, if useTSC, switch the clock over to the TSC
+ */
+void clockInitialize(Bool useTSC)
+{
+    // A reload value of 0 means 65536
+    i686_outb(PIT_COMMAND_PORT, PIT_CHANNEL0_LOHI_MODE2);
+    i686_outb(PIT_CHANNEL0_DATA_PORT, 0);
+    i686_outb(PIT_CHANNEL0_DATA_PORT, 0);
+
+    clock.pitTicks = 0;
+    clock.lastRead = 0;
+    clock.frequency = PIT_FREQUENCY;
+    clockImpl = clock_readPIT;
+
+    if (useTSC) {
+        clock.frequency = clock_calibrateTSC();
+        clockImpl = clock_readTSC;
+    }
+}
+
+/*
+ * The number of clock ticks since some point at boot
+ */
+Uint64 clockRead()
+{
+    return clockImpl();
+}
+
+/*
+ * Called from IRQ0, with interrupts off, each time the PIT counter wraps
+ */
+void clockTick()
+{
+    clock.pitTicks += PIT_PERIOD;
+}
+
+/*
+ * clockRead ticks per second
+ */
+Uint64 clockGetFrequency()
+{
+    return clock.frequency;
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * The ticks counted by clockTick plus how far the counter is into the current period
+ *
+ * The counter counts down from 65536 (read as 0) to 1, so the distance into the period is -count
+ * If IRQ0 is pending the counter has wrapped since the last clockTick, so we are a period further on
+ * The counter is read again after checking, and if it wrapped in between, that wrap is the pending one
+ *
+ * The count never goes backwards. That can only happen at boot, when reinitializing the PIC
+ * can throw away a pending IRQ0 that a reading has already allowed for
+ *
+ * Interrupts are held off so clockTick can't advance the count between our reading the counter and adding it on
+ */
+Uint64 clock_readPIT()
+{
+    Uint32 flags = i686_disableInterruptsSave();
+
+    Uint16 before = (Uint16) (0 - clock_readPITCounter());
+    Bool pending = irqIsPending(0);
+    Uint16 after = (Uint16) (0 - clock_readPITCounter());
+
+    Uint64 ticks;
+    if (after < before) {
+        ticks = clock.pitTicks + PIT_PERIOD + after;
+    } else {
+        ticks = clock.pitTicks + before + (pending ? PIT_PERIOD : 0);
+    }
+    if (ticks < clock.lastRead) {
+        ticks = clock.lastRead;
+    }
+    clock.lastRead = ticks;
+
+    i686_restoreInterrupts(flags);
+
+    return ticks;
+}
+
+Uint64 clock_readTSC()
+{
+    return i686_rdtsc();
+}
+
+Uint16 clock_readPITCounter()
+{
+    i686_outb(PIT_COMMAND_PORT, PIT_CHANNEL0_LATCH);
+    Uint8 low = i686_inb(PIT_CHANNEL0_DATA_PORT);
+    Uint8 high = i686_inb(PIT_CHANNEL0_DATA_PORT);
+
+    return (high << 8) | low;
+}
+
+/*
+ * Count TSC ticks while the PIT counts CALIBRATION_TICKS and scale up to a second
+ *
+ * This runs before IRQ0 is set up, so it adds up the counter's own steps. It reads the counter
+ * far more often than once per wrap, so the 16 bit difference between readings is always right
+ */
+Uint64 clock_calibrateTSC()
+{
+    Uint16 last = clock_readPITCounter();
+    Uint64 tscStart = i686_rdtsc();
+    Uint64 pitTicks = 0;
+
+    while (pitTicks < CALIBRATION_TICKS) {
+        Uint16 count = clock_readPITCounter();
+        pitTicks += (Uint16) (last - count);
+        last = count;
+    }
+
+    Uint64 tscTicks = i686_rdtsc() - tscStart;
+
+    return tscTicks * PIT_FREQUENCY / pitTicks;
+}
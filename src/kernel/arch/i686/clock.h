@@ -0,0 +1,16 @@
+#pragma once
+
+#include "stdtypes.h"
+
+typedef Uint64 (*ClockFn)();
+
+void clockInitialize(Bool useTSC);
+Uint64 clockRead();
+Uint64 clockGetFrequency();
+void clockTick();
+
+/*
+ * The implementation clockRead calls. The PIT until clockInitialize binds the TSC
+ */
+
+extern ClockFn clockImpl;
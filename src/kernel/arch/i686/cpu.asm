@@ -0,0 +1,74 @@
+[bits 32]
+
+;
+; Bool i686_hasCPUID()
+;
+; The CPU supports CPUID if the ID flag (bit 21) in EFLAGS can be toggled
+;
+global i686_hasCPUID
+i686_hasCPUID:
+    pushfd
+    pushfd
+    xor dword [esp], 1 << 21    ; flip ID in the copy
+    popfd
+    pushfd
+    pop eax                     ; EFLAGS as the CPU left it
+    xor eax, [esp]              ; compare with the original
+    popfd                       ; put the original back
+    shr eax, 21
+    and eax, 1
+    ret
+
+;
+; void i686_cpuid(Uint32 leaf, Uint32 subleaf, CPUIDRegisters* regs)
+;
+; Execute CPUID for leaf / subleaf and store eax, ebx, ecx, edx in regs
+;
+global i686_cpuid
+i686_cpuid:
+    push ebx
+    push edi
+
+    mov eax, [esp + 12]         ; leaf
+    mov ecx, [esp + 16]         ; subleaf
+    cpuid
+
+    mov edi, [esp + 20]         ; regs
+    mov [edi], eax
+    mov [edi + 4], ebx
+    mov [edi + 8], ecx
+    mov [edi + 12], edx
+
+    pop edi
+    pop ebx
+    ret
+
+;
+; Uint32 i686_readCR0() / void i686_writeCR0(Uint32 value)
+;
+global i686_readCR0
+i686_readCR0:
+    mov eax, cr0
+    ret
+
+global i686_writeCR0
+i686_writeCR0:
+    mov eax, [esp + 4]
+    mov cr0, eax
+    ret
+
+;
+; Uint32 i686_readCR4() / void i686_writeCR4(Uint32 value)
+;
+; CR4 only exists on CPUs with CPUID. Don't touch it otherwise
+;
+global i686_readCR4
+i686_readCR4:
+    mov eax, cr4
+    ret
+
+global i686_writeCR4
+i686_writeCR4:
+    mov eax, [esp + 4]
+    mov cr4, eax
+    ret
@@ -0,0 +1,227 @@
+#include "cpu.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "isr.h"
+#include "clock.h"
+#include "memory.h"
+#include "crc32c.h"
+
+/*
+ * CPU feature detection and selection of the code paths that depend on it
+ *
+ * https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sdm.html (Vol 2A, CPUID)
+ * https://wiki.osdev.org/CPUID
+ *
+ * CPUID leaf 0 returns the highest basic leaf and the vendor string
+ * Leaf 1 returns the family, model and stepping and most of the feature flags
+ * Leaf 7 returns the extended features, among them ERMS
+ * Leaf 0x80000007 returns the power management features, among them the invariant TSC
+ *
+ * Once the features are known we bind the "alternatives": the memcpy, memset, crc32c and clock
+ * implementations are function pointers that are pointed at the best version for this CPU here,
+ * once at boot, so that every later call goes straight to it without testing the features again
+ */
+
+#define CPUID_LEAF_VENDOR               0x00000000
+#define CPUID_LEAF_FEATURES             0x00000001
+#define CPUID_LEAF_EXTENDED_FEATURES    0x00000007
+#define CPUID_LEAF_MAX_EXTENDED         0x80000000
+#define CPUID_LEAF_POWER_MANAGEMENT     0x80000007
+
+// Leaf 1 EDX
+#define CPUID_EDX_FPU                   (1 << 0)
+#define CPUID_EDX_PSE                   (1 << 3)
+#define CPUID_EDX_TSC                   (1 << 4)
+#define CPUID_EDX_MSR                   (1 << 5)
+#define CPUID_EDX_PAE                   (1 << 6)
+#define CPUID_EDX_APIC                  (1 << 9)
+#define CPUID_EDX_PGE                   (1 << 13)
+#define CPUID_EDX_CMOV                  (1 << 15)
+#define CPUID_EDX_FXSR                  (1 << 24)
+#define CPUID_EDX_SSE                   (1 << 25)
+#define CPUID_EDX_SSE2                  (1 << 26)
+
+// Leaf 1 ECX
+#define CPUID_ECX_SSE3                  (1 << 0)
+#define CPUID_ECX_SSSE3                 (1 << 9)
+#define CPUID_ECX_SSE41                 (1 << 19)
+#define CPUID_ECX_SSE42                 (1 << 20)
+#define CPUID_ECX_X2APIC                (1 << 21)
+#define CPUID_ECX_POPCNT                (1 << 23)
+
+// Leaf 7 EBX
+#define CPUID_EBX_ERMS                  (1 << 9)
+
+// Leaf 0x80000007 EDX
+#define CPUID_EDX_INVARIANT_TSC         (1 << 8)
+
+#define CR0_MP                          (1 << 1)    // Monitor coprocessor: wait / fwait honour TS
+#define CR0_EM                          (1 << 2)    // Emulation: x87 and SSE instructions fault when set
+#define CR4_OSFXSR                      (1 << 9)    // The OS saves SSE state with fxsave, so SSE is allowed
+#define CR4_OSXMMEXCPT                  (1 << 10)   // The OS handles #XM SIMD floating point exceptions
+
+CPUFeatures cpuFeatures;
+
+/*
+ * Forward declarations
+ */
+
+void cpu_detect();
+void cpu_enableSSE();
+void cpu_bindAlternatives();
+void cpu_printFlag(Bool present, const char* name);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+void cpuInitialize()
+{
+    cpu_detect();
+    cpu_enableSSE();
+    cpu_bindAlternatives();
+}
+
+void cpuPrint()
+{
+    CPUFeatures* f = &cpuFeatures;
+
+    printf("CPU: %s family %u model %u stepping %u\n", f->vendor, f->family, f->model, f->stepping);
+    printf("  ");
+    cpu_printFlag(f->pse, "pse");
+    cpu_printFlag(f->pge, "pge");
+    cpu_printFlag(f->pae, "pae");
+    cpu_printFlag(f->tsc, "tsc");
+    cpu_printFlag(f->invariantTSC, "invariant-tsc");
+    cpu_printFlag(f->apic, "apic");
+    cpu_printFlag(f->x2apic, "x2apic");
+    cpu_printFlag(f->sse, "sse");
+    cpu_printFlag(f->sse2, "sse2");
+    cpu_printFlag(f->sse3, "sse3");
+    cpu_printFlag(f->ssse3, "ssse3");
+    cpu_printFlag(f->sse41, "sse4.1");
+    cpu_printFlag(f->sse42, "sse4.2");
+    cpu_printFlag(f->popcnt, "popcnt");
+    cpu_printFlag(f->erms, "erms");
+    printf("\n");
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+void cpu_detect()
+{
+    CPUFeatures* f = &cpuFeatures;
+    CPUIDRegisters regs;
+
+    if (!i686_hasCPUID()) {
+        return;
+    }
+
+    // The vendor string is in EBX, EDX, ECX order
+    i686_cpuid(CPUID_LEAF_VENDOR, 0, &regs);
+    f->maxLeaf = regs.eax;
+    *(Uint32*) &f->vendor[0] = regs.ebx;
+    *(Uint32*) &f->vendor[4] = regs.edx;
+    *(Uint32*) &f->vendor[8] = regs.ecx;
+    f->vendor[12] = '\0';
+
+    if (f->maxLeaf >= CPUID_LEAF_FEATURES) {
+        i686_cpuid(CPUID_LEAF_FEATURES, 0, &regs);
+
+        // The extended family and model only apply to the families that ran out of room in the base fields
+        Uint32 family = (regs.eax >> 8) & 0xF;
+        Uint32 model = (regs.eax >> 4) & 0xF;
+        if (family == 0xF) {
+            family += (regs.eax >> 20) & 0xFF;
+        }
+        if (family == 0x6 || family >= 0xF) {
+            model += ((regs.eax >> 16) & 0xF) << 4;
+        }
+        f->family = family;
+        f->model = model;
+        f->stepping = regs.eax & 0xF;
+
+        f->fpu    = (regs.edx & CPUID_EDX_FPU) != 0;
+        f->pse    = (regs.edx & CPUID_EDX_PSE) != 0;
+        f->tsc    = (regs.edx & CPUID_EDX_TSC) != 0;
+        f->msr    = (regs.edx & CPUID_EDX_MSR) != 0;
+        f->pae    = (regs.edx & CPUID_EDX_PAE) != 0;
+        f->apic   = (regs.edx & CPUID_EDX_APIC) != 0;
+        f->pge    = (regs.edx & CPUID_EDX_PGE) != 0;
+        f->cmov   = (regs.edx & CPUID_EDX_CMOV) != 0;
+        f->fxsr   = (regs.edx & CPUID_EDX_FXSR) != 0;
+        f->sse    = (regs.edx & CPUID_EDX_SSE) != 0;
+        f->sse2   = (regs.edx & CPUID_EDX_SSE2) != 0;
+        f->sse3   = (regs.ecx & CPUID_ECX_SSE3) != 0;
+        f->ssse3  = (regs.ecx & CPUID_ECX_SSSE3) != 0;
+        f->sse41  = (regs.ecx & CPUID_ECX_SSE41) != 0;
+        f->sse42  = (regs.ecx & CPUID_ECX_SSE42) != 0;
+        f->x2apic = (regs.ecx & CPUID_ECX_X2APIC) != 0;
+        f->popcnt = (regs.ecx & CPUID_ECX_POPCNT) != 0;
+    }
+
+    if (f->maxLeaf >= CPUID_LEAF_EXTENDED_FEATURES) {
+        i686_cpuid(CPUID_LEAF_EXTENDED_FEATURES, 0, &regs);
+        f->erms = (regs.ebx & CPUID_EBX_ERMS) != 0;
+    }
+
+    i686_cpuid(CPUID_LEAF_MAX_EXTENDED, 0, &regs);
+    f->maxExtendedLeaf = regs.eax;
+
+    if (f->maxExtendedLeaf >= CPUID_LEAF_POWER_MANAGEMENT) {
+        i686_cpuid(CPUID_LEAF_POWER_MANAGEMENT, 0, &regs);
+        f->invariantTSC = (regs.edx & CPUID_EDX_INVARIANT_TSC) != 0;
+    }
+}
+
+/*
+ * Allow SSE instructions: clear CR0.EM, set CR0.MP, and tell the CPU we save the XMM registers with fxsave
+ *
+ * Interrupt handlers can run in the middle of an SSE memcpy and use the XMM registers themselves,
+ * so from now on the common ISR stub saves and restores them around every handler
+ */
+void cpu_enableSSE()
+{
+    if (!cpuFeatures.fxsr || !cpuFeatures.sse) {
+        return;
+    }
+
+    i686_writeCR0((i686_readCR0() & ~CR0_EM) | CR0_MP);
+    i686_writeCR4(i686_readCR4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+    i686_isrSaveSSE = true;
+    cpuFeatures.sseEnabled = true;
+}
+
+/*
+ * Point each alternative at the best implementation this CPU can run
+ *
+ * memcpy / memset  ERMS if the microcode is fast, else SSE2 if enabled, else rep movsd / stosd
+ * crc32c           The SSE4.2 crc32 instruction, else the table
+ * clock            The TSC if it ticks at a constant rate, else the PIT
+ */
+void cpu_bindAlternatives()
+{
+    if (cpuFeatures.erms) {
+        memcpyImpl = memcpyERMS;
+        memsetImpl = memsetERMS;
+    } else if (cpuFeatures.sseEnabled && cpuFeatures.sse2) {
+        memcpyImpl = memcpySSE2;
+        memsetImpl = memsetSSE2;
+    }
+
+    if (cpuFeatures.sse42) {
+        crc32cImpl = crc32cSSE42;
+    }
+
+    clockInitialize(cpuFeatures.tsc && cpuFeatures.invariantTSC);
+}
+
+void cpu_printFlag(Bool present, const char* name)
+{
+    if (present) {
+        printf("%s ", name);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "stdtypes.h"
+
+typedef struct {
+    Uint32 eax, ebx, ecx, edx;
+} CPUIDRegisters;
+
+/*
+ * What CPUID says the processor can do
+ *
+ * All false if the CPU is too old to have CPUID
+ */
+typedef struct {
+    char    vendor[13];         // e.g. "GenuineIntel", "AuthenticAMD". Null terminated
+    Uint32  maxLeaf;
+    Uint32  maxExtendedLeaf;
+    Uint8   family;
+    Uint8   model;
+    Uint8   stepping;
+
+    Bool    fpu;
+    Bool    pse;                // 4MB pages
+    Bool    tsc;                // rdtsc
+    Bool    msr;
+    Bool    pae;
+    Bool    apic;
+    Bool    pge;                // Global pages
+    Bool    cmov;
+    Bool    fxsr;               // fxsave / fxrstor
+    Bool    sse;
+    Bool    sse2;
+    Bool    sse3;
+    Bool    ssse3;
+    Bool    sse41;
+    Bool    sse42;              // Including the crc32 instruction
+    Bool    popcnt;
+    Bool    x2apic;
+    Bool    erms;               // Enhanced REP MOVSB/STOSB
+    Bool    invariantTSC;       // The TSC ticks at a constant rate in every P-, C- and T-state
+
+    Bool    sseEnabled;         // CR0 and CR4 are set up so SSE instructions may be used
+} CPUFeatures;
+
+extern CPUFeatures cpuFeatures;
+
+void cpuInitialize();
+void cpuPrint();
+
+Bool __attribute__((cdecl)) i686_hasCPUID();
+void __attribute__((cdecl)) i686_cpuid(Uint32 leaf, Uint32 subleaf, CPUIDRegisters* regs);
+Uint32 __attribute__((cdecl)) i686_readCR0();
+void __attribute__((cdecl)) i686_writeCR0(Uint32 value);
+Uint32 __attribute__((cdecl)) i686_readCR4();
+void __attribute__((cdecl)) i686_writeCR4(Uint32 value);
@@ -53,3 +53,55 @@ global i686_enableInterrupts
 i686_enableInterrupts:
     sti
     ret
+
+;
+; Uint64 i686_rdtsc()
+;
+; Read the time stamp counter. The result is returned in EDX:EAX as cdecl expects for a 64 bit value
+;
+global i686_rdtsc
+i686_rdtsc:
+    [bits 32]
+    rdtsc
+    ret
+
+;
+; Uint32 i686_disableInterruptsSave()
+;
+; Disable interrupts and return the previous EFLAGS, so that code which may run in an interrupt handler
+; can put the interrupt flag back as it found it with i686_restoreInterrupts
+;
+global i686_disableInterruptsSave
+i686_disableInterruptsSave:
+    [bits 32]
+    pushfd
+    pop eax
+    cli
+    ret
+
+;
+; void i686_restoreInterrupts(Uint32 flags)
+;
+; Re-enable interrupts if they were enabled when i686_disableInterruptsSave returned flags
+;
+global i686_restoreInterrupts
+i686_restoreInterrupts:
+    [bits 32]
+    test dword [esp + 4], 1 << 9    ; IF
+    jz .done
+    sti
+.done:
+    ret
+
+;
+; void i686_waitForInterrupt()
+;
+; Enable interrupts and sleep until the next one has been handled
+; sti only takes effect after the following instruction, so an interrupt can't slip in before the hlt
+;
+global i686_waitForInterrupt
+i686_waitForInterrupt:
+    [bits 32]
+    sti
+    hlt
+    ret
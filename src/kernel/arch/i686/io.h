@@ -6,8 +6,13 @@ Uint8 __attribute__((cdecl)) i686_inb(Uint16 port);
 
 void __attribute__((cdecl)) i686_disableInterrupts();
 void __attribute__((cdecl)) i686_enableInterrupts();
+Uint32 __attribute__((cdecl)) i686_disableInterruptsSave();
+void __attribute__((cdecl)) i686_restoreInterrupts(Uint32 flags);
 
 void __attribute__((cdecl)) i686_halt();
+void __attribute__((cdecl)) i686_waitForInterrupt();
+
+Uint64 __attribute__((cdecl)) i686_rdtsc();
 
 
 void i686_iowait();
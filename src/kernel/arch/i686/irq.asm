@@ -0,0 +1,165 @@
+[bits 32]
+
+;
+; Direct IRQ entry stubs
+;
+; The generic path for an IRQ is isr_common (pusha, segment reloads), isrHandler, irqCommonHandler,
+; then the device handler and a call to picSendEndOfInterrupt. These stubs do the same job with
+; a frame of just the three registers a cdecl call may clobber, one indirect call and the EOI inline:
+; a single store to the local APIC when there is one, port writes to the PIC otherwise
+;
+; They assume the interrupted code was running in the kernel with the kernel data segments loaded,
+; which is always true while there is no user mode. The generic path is still there, and
+; irqSetDirect switches an IRQ back to it
+;
+; At the point the device handler is called the stack looks like
+;
+;   EFLAGS
+;   CS
+;   EIP
+;   EAX
+;   ECX
+;   EDX
+;   IRQ number
+;   (fxsave area if i686_isrSaveSSE)
+;   return address into irq_direct
+;   EBX             <-- irq_dispatch keeps the IRQ number in ebx
+;   IRQ number      <-- the irq parameter of the handler, a copy the handler may change
+;
+; After the EOI the same stub runs up to DEFERRED_IRQ_BATCH items of deferred work with interrupts on
+;
+
+%macro MAKE_IRQ_STUBS 1
+  %assign ii 0
+  %rep %1
+    %defstr sii ii
+    %strcat svar 'i686_IRQ_', sii
+    %deftok var svar
+    var:
+    push eax
+    push ecx
+    push edx
+    push ii
+    jmp irq_direct
+
+    %assign ii ii+1
+  %endrep
+
+  %assign ii 0
+  global i686_irqTable
+  i686_irqTable:
+  %rep %1
+    %defstr sii ii
+    %strcat svar 'i686_IRQ_', sii
+    %deftok var svar
+    dd var
+    %assign ii ii+1
+  %endrep
+%endmacro
+
+PIC1_COMMAND_PORT   equ 0x20
+PIC2_COMMAND_PORT   equ 0xA0
+PIC_EOI             equ 0x20
+
+MAKE_IRQ_STUBS 16
+
+extern irqHandlers
+extern irqCounters
+extern i686_isrSaveSSE
+extern apicEOIRegister
+extern irqIsSpurious
+extern irqAfterInterrupt
+
+irq_direct:
+    cld                     ; The interrupted code may be in the middle of a backwards memmove
+
+    mov eax, [esp]          ; ++*irqCounters[irq]
+    mov eax, [irqCounters + eax * 4]
+    add dword [eax], 1
+    adc dword [eax + 4], 0
+
+    mov eax, [esp]
+
+    ; Save the XMM registers as isr_common does, since the deferred work may use them too
+    ; The old esp is kept just below the save area
+    cmp byte [i686_isrSaveSSE], 0
+    jne .saveSSE
+
+    call irq_dispatch
+    jmp .done
+
+.saveSSE:
+    mov ecx, esp
+    sub esp, 512 + 16
+    and esp, ~15
+    fxsave [esp + 16]
+    mov [esp + 12], ecx
+
+    call irq_dispatch
+
+    fxrstor [esp + 16]
+    mov esp, [esp + 12]
+
+.done:
+    add esp, 4              ; IRQ number
+    pop edx
+    pop ecx
+    pop eax
+    iret
+
+;
+; Call the handler for the IRQ in eax, end the interrupt, then run deferred work
+; A spurious IRQ7 or IRQ15 is dropped without calling the handler. irqIsSpurious sends any EOI it needs
+; Clobbers eax, ecx and edx
+;
+; The IRQ number is kept in ebx, which the C functions preserve. Under cdecl the argument slot
+; belongs to the callee, which may change it, so each call gets a fresh copy
+;
+irq_dispatch:
+    push ebx
+    mov ebx, eax
+
+    ; The 8259 raises IRQ7 or IRQ15 when an interrupt goes away before it can say which it was
+    cmp ebx, 7
+    je .checkSpurious
+    cmp ebx, 15
+    jne .handler
+
+.checkSpurious:
+    push ebx
+    call irqIsSpurious
+    add esp, 4
+    test al, al
+    jnz .return
+
+.handler:
+    push ebx
+    call [irqHandlers + ebx * 4]
+    add esp, 4
+
+    ; With the APIC, a store to the local APIC's EOI register
+    mov eax, [apicEOIRegister]
+    test eax, eax
+    jz .pic
+    mov dword [eax], 0
+    jmp .deferred
+
+.pic:
+    ; Otherwise a non-specific EOI to the master, and to the slave first for IRQs 8 - 15
+    mov al, PIC_EOI
+    cmp ebx, 8
+    jb .master
+    out PIC2_COMMAND_PORT, al
+.master:
+    out PIC1_COMMAND_PORT, al
+
+.deferred:
+    ; Storm accounting, then deferred work. Interrupts come back on in here,
+    ; so this IRQ may fire again before we return
+    push ebx
+    call irqAfterInterrupt
+    add esp, 4
+
+.return:
+    pop ebx
+    ret
@@ -1,40 +1,364 @@
 #include "irq.h"
 #include "stdtypes.h"
 #include "pic.h"
+#include "apic.h"
 #include "io.h"
+#include "idt.h"
+#include "gdt.h"
 #include "stdio.h"
+#include "deferred.h"
+#include "klog.h"
+#include "clock.h"
 
-#define PIC_BASE_IVN 0x20
-#define MAX_NUM_IRQS 16
+/*
+ * Hardware interrupts
+ *
+ * The ISA IRQs are routed through the I/O APIC when the MADT describes one, and through
+ * the 8259 PIC otherwise. Either way IRQ n arrives on vector PIC_BASE_IVN + n, so drivers
+ * register the same handlers with irqRegisterHandler and don't need to know which it is
+ * The PIC is always remapped, so that even when it is masked a stray interrupt from it
+ * can't land on an exception vector
+ *
+ * Each IRQ enters through its own stub in irq.asm, which calls irqHandlers[irq] directly and sends
+ * the EOI itself, then runs a bounded batch of deferred work with interrupts enabled
+ * irqSetDirect can route an IRQ through the generic isr_common path instead, which has the full
+ * register frame and timing statistics, at the cost of two more dispatches
+ *
+ * Spurious interrupts: when an interrupt goes away between the 8259 raising INTR and the CPU
+ * acknowledging it, the 8259 reports its lowest priority line, IRQ7 or IRQ15, without setting
+ * the line's bit in its In-Service Register. Both paths check the ISR for those two lines and drop
+ * a spurious one. It must not be EOIed, except that a spurious IRQ15 did go through the cascade
+ * on the master, which needs its EOI. The PIC runs with normal EOI for this, since auto EOI clears
+ * the ISR bit before we could look at it. With the APIC the PIC is moved to its own vectors,
+ * where anything it still raises is counted as spurious and otherwise ignored
+ *
+ * Storms: every IRQ counts towards its line's total for the current timer tick. A line that passes
+ * IRQ_STORM_THRESHOLD in a tick is masked, and from then on its handler is polled once per tick
+ * instead. After backoff ticks the line is unmasked to see whether it has calmed down. Each storm
+ * in a row doubles the backoff, up to IRQ_MAX_BACKOFF, and a tick at under half the threshold
+ * resets it. Handlers must therefore cope with being called when their device has nothing for them,
+ * which they have to anyway for shared and level triggered lines. IRQ0 drives all this, so it is
+ * never masked
+ */
 
-IRQHandler irqHandlers[MAX_NUM_IRQS];
+#define IRQ_TIMER               0
+#define IRQ_STORM_THRESHOLD     2000    // In one tick of about 55ms, so about 36000 per second
+#define IRQ_QUIET_THRESHOLD     (IRQ_STORM_THRESHOLD / 2)
+#define IRQ_INITIAL_BACKOFF     2       // Ticks
+#define IRQ_MAX_BACKOFF         256     // Ticks, about 14 seconds
+#define PIC_APIC_MODE_IVN       0x30    // Where the PIC's vectors go when the APIC is in use
 
+typedef struct {
+    Uint32  tickCount;          // IRQs since the last tick
+    Uint32  backoff;            // Ticks the line is masked for if it storms again. 0 when it has been quiet
+    Uint32  pollTicks;          // Ticks left before it is unmasked. 0 when not polled
+    Uint32  storms;
+    Uint32  spurious;
+    Bool    untracked;          // Storm detection is suspended, e.g. while a benchmark raises the vector itself
+} IRQLine;
+
+/*
+ * Forward declarations
+ */
+
+void irq_unhandled(int irq);
+void irq_ignore(int irq);
+void irq_timer(int irq);
+void irq_tick();
+void irq_startPolling(int irq);
+void irq_picSpurious(ISRRegisters* regs);
+
+IRQHandler irqHandlers[MAX_NUM_IRQS];          // Called by the stubs in irq.asm. Never NULL
+Uint64* irqCounters[MAX_NUM_IRQS];             // isrHandler's count for each IRQ, so the stubs can bump it
+Bool irqUseAPIC = false;
+IRQLine irqLines[MAX_NUM_IRQS];
+Uint32 irqPICSpurious;                          // Raised by the PIC while the APIC is in use
+IRQHandler irqTimerHandler;                     // Registered for IRQ0, called by irq_timer
+
+extern void* i686_irqTable[];
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+void irqInitialize()
+{
+    // Interrupts are still off from the boot, so the PIC can be left until we know where it goes
+    irqUseAPIC = apicInitialize(PIC_BASE_IVN);
+
+    // Leaves every PIC IRQ masked
+    if (irqUseAPIC) {
+        picInitialize(PIC_APIC_MODE_IVN, PIC_APIC_MODE_IVN + 8, false);
+        for (int ii = 0; ii < MAX_NUM_IRQS; ++ii) {
+            isrRegisterHandler(PIC_APIC_MODE_IVN + ii, irq_picSpurious);
+        }
+    } else {
+        picInitialize(PIC_BASE_IVN, PIC_BASE_IVN + 8, false);
+    }
+
+    deferredInitialize();
+
+    for (int ii = 0; ii < MAX_NUM_IRQS; ++ii) {
+        irqHandlers[ii] = irq_unhandled;
+        irqCounters[ii] = isrGetCounter(PIC_BASE_IVN + ii);
+        isrRegisterHandler(PIC_BASE_IVN + ii, irqCommonHandler);
+        irqSetDirect(ii, true);
+    }
+
+    // The clock and storm detection count in timer ticks, whether or not anyone else wants them
+    irqTimerHandler = irq_ignore;
+    irqHandlers[IRQ_TIMER] = irq_timer;
+    irqUnmask(IRQ_TIMER);
+
+    i686_enableInterrupts();
+}
+
+/*
+ * IRQ0 always runs irq_timer, which calls handler after its own work
+ */
 void irqRegisterHandler(int irq, IRQHandler handler)
 {
-    irqHandlers[irq] = handler;
-    picUnmask(irq);
+    if (irq == IRQ_TIMER) {
+        irqTimerHandler = handler;
+    } else {
+        irqHandlers[irq] = handler;
+    }
+    irqUnmask(irq);
+}
+
+/*
+ * Suspend or resume storm detection for irq
+ *
+ * For code that raises the vector with int, which would otherwise look like a storm
+ * Resuming starts a fresh count, so the interrupts raised meanwhile don't count towards one
+ */
+void irqTrackStorms(int irq, Bool track)
+{
+    Uint32 flags = i686_disableInterruptsSave();
+
+    irqLines[irq].untracked = !track;
+    irqLines[irq].tickCount = 0;
+
+    i686_restoreInterrupts(flags);
+}
+
+/*
+ * Whether irq has been raised and is waiting for the CPU to take it
+ */
+Bool irqIsPending(int irq)
+{
+    if (irqUseAPIC) {
+        return apicIsPending(PIC_BASE_IVN + irq);
+    }
+
+    return (picGetIRR() & (1 << irq)) != 0;
+}
+
+/*
+ * Lines that have stormed or raised spurious interrupts
+ */
+void irqPrint()
+{
+    for (int ii = 0; ii < MAX_NUM_IRQS; ++ii) {
+        IRQLine* line = &irqLines[ii];
+        if (line->storms > 0 || line->spurious > 0) {
+            printf("IRQ %d: %u storms, %u spurious%s\n",
+                ii, line->storms, line->spurious, line->pollTicks > 0 ? ", polled" : "");
+        }
+    }
+
+    if (irqPICSpurious > 0) {
+        printf("PIC: %u interrupts while masked for the APIC\n", irqPICSpurious);
+    }
+}
+
+void irqMask(int irq)
+{
+    if (irqUseAPIC) {
+        apicMask(irq);
+    } else {
+        picMask(irq);
+    }
+}
+
+void irqUnmask(int irq)
+{
+    if (irqUseAPIC) {
+        apicUnmask(irq);
+    } else {
+        picUnmask(irq);
+    }
+}
+
+/*
+ * Route irq through its direct stub, or through isr_common and isrHandler
+ */
+void irqSetDirect(int irq, Bool direct)
+{
+    void* entry = direct ? i686_irqTable[irq] : i686_isrTable[PIC_BASE_IVN + irq];
+
+    idtSetGate(PIC_BASE_IVN + irq, entry, GDT_CODE_SEGMENT, IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_GATE_32BIT_INT);
 }
 
+/*
+ * The generic path, called by isrHandler for an IRQ that isn't direct
+ */
 void irqCommonHandler(ISRRegisters* regs)
 {
     int irq = regs->vectorNumber - PIC_BASE_IVN;
 
-    if (irqHandlers[irq] != NULL) {
-        irqHandlers[irq](regs);
+    if ((irq == 7 || irq == 15) && irqIsSpurious(irq)) {
+        return;
+    }
+
+    irqHandlers[irq](irq);
+
+    if (irqUseAPIC) {
+        apicEndOfInterrupt();
+    } else {
+        picSendEndOfInterrupt(irq);
+    }
+
+    // isrHandler runs the deferred work once it has timed this
+    irqCountInterrupt(irq);
+}
+
+/*
+ * Whether IRQ7 or IRQ15 from the PIC is spurious, i.e. its In-Service bit isn't set
+ *
+ * For a spurious IRQ15 this sends the master its EOI for the cascade
+ */
+Bool irqIsSpurious(int irq)
+{
+    if (irqUseAPIC || (picGetISR() & (1 << irq)) != 0) {
+        return false;
+    }
+
+    ++irqLines[irq].spurious;
+    if (irq >= 8) {
+        picSendEndOfInterrupt(0);       // Master only
+    }
+
+    return true;
+}
+
+/*
+ * Called by the direct stubs on the way out of every IRQ, after its EOI and with interrupts still off
+ */
+void irqAfterInterrupt(int irq)
+{
+    irqCountInterrupt(irq);
+    irqRunDeferred();
+}
+
+/*
+ * Count an IRQ towards its line's storm threshold, after its EOI and with interrupts still off
+ *
+ * Catches a storming line as soon as it passes the threshold, even if it is keeping
+ * the timer from getting a look in
+ */
+void irqCountInterrupt(int irq)
+{
+    IRQLine* line = &irqLines[irq];
+
+    if (irq != IRQ_TIMER && !line->untracked && ++line->tickCount > IRQ_STORM_THRESHOLD && line->pollTicks == 0) {
+        irq_startPolling(irq);
+    }
+}
+
+/*
+ * Run deferred work on the way out of an interrupt, after the EOI
+ *
+ * Interrupts are enabled while it runs, so other IRQs, and this one again, can be taken
+ * They queue their work and leave it to this call without turning interrupts on, so the nesting is one deep
+ * Whatever doesn't fit in the batch waits for the next interrupt or the idle loop
+ */
+void irqRunDeferred()
+{
+    // Interrupts are still off, so nothing can change either of these under us
+    if (!deferredPending() || deferredRunning()) {
+        return;
+    }
+
+    i686_enableInterrupts();
+    deferredRun(DEFERRED_IRQ_BATCH);
+    i686_disableInterrupts();
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+void irq_unhandled(int irq)
+{
+    if (irqUseAPIC) {
+        printf("Unhandled IRQ %d\n", irq);
     } else {
         printf("Unhandled IRQ %d, ISR = %x, IRR = %x\n", irq, picGetISR(), picGetIRR());
     }
+}
 
-    picSendEndOfInterrupt(irq);
+void irq_ignore(int irq)
+{
 }
 
-void irqInitialize()
+/*
+ * IRQ0. The tick comes first so that the clock has counted this wrap of the PIT
+ * before the registered handler reads it
+ */
+void irq_timer(int irq)
+{
+    irq_tick();
+    irqTimerHandler(irq);
+}
+
+/*
+ * Once per timer tick: keep the PIT clock's count, poll the masked lines,
+ * unmask those whose backoff is over, and start a new count for the rest
+ */
+void irq_tick()
 {
-    picInitialize(PIC_BASE_IVN, PIC_BASE_IVN + 8, true);
+    clockTick();
 
     for (int ii = 0; ii < MAX_NUM_IRQS; ++ii) {
-        isrRegisterHandler(PIC_BASE_IVN + ii, irqCommonHandler);
+        IRQLine* line = &irqLines[ii];
+
+        if (line->pollTicks > 0) {
+            irqHandlers[ii](ii);
+            if (--line->pollTicks == 0) {
+                irqUnmask(ii);
+            }
+        } else if (line->tickCount < IRQ_QUIET_THRESHOLD) {
+            line->backoff = 0;
+        }
+
+        line->tickCount = 0;
     }
+}
 
-    i686_enableInterrupts();
+void irq_startPolling(int irq)
+{
+    IRQLine* line = &irqLines[irq];
+
+    if (line->backoff == 0) {
+        line->backoff = IRQ_INITIAL_BACKOFF;
+    } else if (line->backoff < IRQ_MAX_BACKOFF) {
+        line->backoff *= 2;
+    }
+
+    irqMask(irq);
+    line->pollTicks = line->backoff;
+    ++line->storms;
+
+    klog(KLOG_WARNING, "IRQ %d: storm, %u in one tick. Polling for %u ticks", irq, line->tickCount, line->backoff);
+}
+
+/*
+ * A vector the PIC would use while the APIC is in charge
+ *
+ * Every line is masked, so this can only be a spurious IRQ7 or IRQ15, which gets no EOI
+ */
+void irq_picSpurious(ISRRegisters* regs)
+{
+    ++irqPICSpurious;
 }
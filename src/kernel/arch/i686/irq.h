@@ -2,8 +2,21 @@
 
 #include "isr.h"
 
-typedef ISRRegisters IRQRegisters;
-typedef void (*IRQHandler)(IRQRegisters* regs);
+#define PIC_BASE_IVN 0x20
+#define MAX_NUM_IRQS 16
+
+typedef void (*IRQHandler)(int irq);
 
 void irqInitialize();
 void irqRegisterHandler(int irq, IRQHandler handler);
+void irqMask(int irq);
+void irqUnmask(int irq);
+Bool irqIsPending(int irq);
+void irqTrackStorms(int irq, Bool track);
+void irqSetDirect(int irq, Bool direct);
+void irqCommonHandler(ISRRegisters* regs);
+void irqRunDeferred();
+Bool irqIsSpurious(int irq);
+void irqAfterInterrupt(int irq);
+void irqCountInterrupt(int irq);
+void irqPrint();
@@ -72,9 +72,11 @@ MAKE_ISRS 8, 10, 11, 12, 13, 14, 17, 21
 ;
 
 extern isrHandler
+extern i686_isrSaveSSE
 global isr_common
 isr_common:
     pusha               ; pushes in order: eax, ecx, edx, ebx, esp, ebp, esi, edi
+    cld                 ; The interrupted code may be in the middle of a backwards memmove
 
     xor eax, eax        ; push ds
     mov ax, ds
@@ -87,10 +89,28 @@ isr_common:
     mov fs, ax
     mov gs, ax
     
-    push esp            ; pass pointer to stack to C, so we can access all the pushed information
+    mov ebx, esp        ; pointer to all the pushed information. ebx survives the call
+
+    ; Once SSE is enabled the handler may use the XMM registers, perhaps in the middle of
+    ; an SSE memcpy of the code it interrupted, so save them in a 16 byte aligned area below
+    cmp byte [i686_isrSaveSSE], 0
+    je .call
+    sub esp, 512
+    and esp, ~15
+    fxsave [esp]
+
+.call:
+    push ebx            ; pass pointer to stack to C, so we can access all the pushed information
     call isrHandler
     add esp, 4
 
+    cmp byte [i686_isrSaveSSE], 0
+    je .restored
+    fxrstor [esp]
+
+.restored:
+    mov esp, ebx
+
     pop eax             ; restore old segment
     mov ds, ax
     mov es, ax
@@ -13,5 +13,29 @@ typedef struct
 
 typedef void (*ISRHandler)(ISRRegisters* regs);
 
+#define ISR_HISTOGRAM_BUCKETS   32      // Bucket n counts handlers that took [2^n, 2^(n+1)) cycles
+
+/*
+ * What isrHandler has seen of one vector since the last isrResetStatistics
+ *
+ * Durations are TSC cycles spent in the C handler, including the EOI for IRQs
+ * They stay zero on a CPU without a TSC, where only count is kept,
+ * and for IRQs taking the direct path, which bumps count from irq.asm
+ */
+typedef struct {
+    Uint64  count;
+    Uint64  totalCycles;
+    Uint32  minCycles;
+    Uint32  maxCycles;
+    Uint32  histogram[ISR_HISTOGRAM_BUCKETS];
+} ISRStatistics;
+
+extern Bool i686_isrSaveSSE;
+extern void* i686_isrTable[];
+
 void isrInitialize();
 void isrRegisterHandler(int vectorNumber, ISRHandler handler);
+Uint64* isrGetCounter(int vectorNumber);
+void isrGetStatistics(int vectorNumber, ISRStatistics* stats);
+void isrResetStatistics();
+void isrPrintStatistics();
@@ -0,0 +1,230 @@
+#include "serial.h"
+#include "stdtypes.h"
+#include "io.h"
+#include "irq.h"
+
+/*
+ * Serial console on COM1, a 16550 UART
+ *
+ * https://wiki.osdev.org/Serial_Ports
+ * https://www.ti.com/lit/ds/symlink/pc16550d.pdf
+ *
+ * Output is queued in a ring buffer and serialWrite returns straight away
+ * The UART raises IRQ4 when its transmit holding register is empty (THRE) and the handler
+ * refills the 16 byte transmit FIFO from the ring, so the caller never waits on the line
+ * The THRE interrupt is only enabled while the ring has something in it
+ *
+ * The ring has one producer and one consumer so needs no lock: only serialWrite moves head
+ * and only the interrupt handler (or serialFlush) moves tail
+ * There must only be one writer at a time, which stdio ensures by holding interrupts off
+ *
+ * If the ring fills up, further output is dropped and counted rather than making the caller wait
+ * serialFlush drains the ring by polling, for paths such as a panic where interrupts won't come again
+ *
+ * Under QEMU, -serial file:serial.log captures everything written
+ */
+
+#define COM1_PORT                   0x3F8
+#define COM1_IRQ                    4
+
+#define UART_DATA                   (COM1_PORT + 0)     // THR / RBR. Divisor low byte when DLAB is set
+#define UART_INTERRUPT_ENABLE       (COM1_PORT + 1)     // IER. Divisor high byte when DLAB is set
+#define UART_INTERRUPT_ID           (COM1_PORT + 2)     // IIR when read
+#define UART_FIFO_CONTROL           (COM1_PORT + 2)     // FCR when written
+#define UART_LINE_CONTROL           (COM1_PORT + 3)     // LCR
+#define UART_MODEM_CONTROL          (COM1_PORT + 4)     // MCR
+#define UART_LINE_STATUS            (COM1_PORT + 5)     // LSR
+#define UART_MODEM_STATUS           (COM1_PORT + 6)     // MSR
+
+#define UART_CLOCK                  115200
+#define UART_BAUD_RATE              115200
+
+#define IER_THR_EMPTY               0x02
+
+#define IIR_NO_INTERRUPT            0x01
+#define IIR_ID_MASK                 0x0E
+#define IIR_MODEM_STATUS            0x00
+#define IIR_THR_EMPTY               0x02
+#define IIR_RECEIVED_DATA           0x04
+#define IIR_LINE_STATUS             0x06
+#define IIR_RECEIVE_TIMEOUT         0x0C
+
+#define FCR_ENABLE_CLEAR_14         0xC7    // Enable the FIFOs, clear them, receive trigger at 14 bytes
+#define LCR_DLAB                    0x80    // Divisor latch access
+#define LCR_8N1                     0x03    // 8 data bits, no parity, 1 stop bit
+#define MCR_LOOPBACK_TEST           0x1E    // Loopback, with RTS, OUT1 and OUT2 set
+#define MCR_NORMAL                  0x0B    // DTR, RTS and OUT2, which gates the interrupt line to the PIC
+#define LSR_THR_EMPTY               0x20
+
+#define LOOPBACK_TEST_BYTE          0xAE
+#define TX_FIFO_SIZE                16
+#define TX_RING_SIZE                8192    // Must be a power of two
+
+typedef struct {
+    Bool            present;
+    Bool            txActive;       // The THRE interrupt is enabled
+    volatile Uint32 head;           // Next free slot. Only moved by serialWrite
+    volatile Uint32 tail;           // Next byte to send. Only moved by the consumer
+    Uint32          dropped;
+    char            ring[TX_RING_SIZE];
+} Serial;
+
+Serial serial;
+
+/*
+ * Forward declarations
+ */
+
+void serial_put(char c);
+void serial_fillFIFO();
+void serial_irqHandler(int irq);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Set COM1 up for 115200 8N1 with FIFOs and hook up IRQ4
+ *
+ * Returns false, and output to the serial port is discarded, if there is no working UART
+ */
+Bool serialInitialize()
+{
+    i686_outb(UART_INTERRUPT_ENABLE, 0);
+
+    Uint16 divisor = UART_CLOCK / UART_BAUD_RATE;
+    i686_outb(UART_LINE_CONTROL, LCR_DLAB);
+    i686_outb(UART_DATA, divisor & 0xFF);
+    i686_outb(UART_INTERRUPT_ENABLE, divisor >> 8);
+    i686_outb(UART_LINE_CONTROL, LCR_8N1);
+
+    i686_outb(UART_FIFO_CONTROL, FCR_ENABLE_CLEAR_14);
+
+    // A byte sent in loopback mode should come straight back if there is a UART there
+    i686_outb(UART_MODEM_CONTROL, MCR_LOOPBACK_TEST);
+    i686_outb(UART_DATA, LOOPBACK_TEST_BYTE);
+    if (i686_inb(UART_DATA) != LOOPBACK_TEST_BYTE) {
+        serial.present = false;
+        return false;
+    }
+
+    i686_outb(UART_MODEM_CONTROL, MCR_NORMAL);
+
+    serial.head = 0;
+    serial.tail = 0;
+    serial.txActive = false;
+    serial.present = true;
+
+    irqRegisterHandler(COM1_IRQ, serial_irqHandler);
+
+    return true;
+}
+
+/*
+ * Queue c for sending. Newlines go out as CR LF
+ */
+void serialWrite(char c)
+{
+    if (!serial.present) {
+        return;
+    }
+
+    if (c == '\n') {
+        serial_put('\r');
+    }
+    serial_put(c);
+
+    // Enabling the interrupt while the transmitter is empty raises it straight away
+    if (!serial.txActive) {
+        serial.txActive = true;
+        i686_outb(UART_INTERRUPT_ENABLE, IER_THR_EMPTY);
+    }
+}
+
+/*
+ * Send everything in the ring by polling the UART. For use with interrupts disabled
+ */
+void serialFlush()
+{
+    if (!serial.present) {
+        return;
+    }
+
+    while (serial.tail != serial.head) {
+        while ((i686_inb(UART_LINE_STATUS) & LSR_THR_EMPTY) == 0) {
+        }
+        serial_fillFIFO();
+    }
+}
+
+/*
+ * The number of bytes thrown away because the ring was full
+ */
+Uint32 serialGetDropped()
+{
+    return serial.dropped;
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+void serial_put(char c)
+{
+    if (serial.head - serial.tail >= TX_RING_SIZE) {
+        ++serial.dropped;
+        return;
+    }
+
+    serial.ring[serial.head & (TX_RING_SIZE - 1)] = c;
+    __asm__ __volatile__ ("" ::: "memory");     // The byte must be in the ring before head says so
+    ++serial.head;
+}
+
+/*
+ * Move up to a FIFO's worth from the ring to the UART, which must have an empty transmitter
+ *
+ * Once the ring is empty the THRE interrupt is turned off until serialWrite has more
+ */
+void serial_fillFIFO()
+{
+    for (int ii = 0; ii < TX_FIFO_SIZE && serial.tail != serial.head; ++ii) {
+        i686_outb(UART_DATA, serial.ring[serial.tail & (TX_RING_SIZE - 1)]);
+        ++serial.tail;
+    }
+
+    if (serial.tail == serial.head && serial.txActive) {
+        serial.txActive = false;
+        i686_outb(UART_INTERRUPT_ENABLE, 0);
+    }
+}
+
+void serial_irqHandler(int irq)
+{
+    for (;;) {
+        Uint8 iir = i686_inb(UART_INTERRUPT_ID);
+        if (iir & IIR_NO_INTERRUPT) {
+            break;
+        }
+
+        switch (iir & IIR_ID_MASK) {
+        case IIR_THR_EMPTY:
+            serial_fillFIFO();
+            break;
+
+        // We don't enable these, but clear them in case the UART raises them anyway
+        case IIR_RECEIVED_DATA:
+        case IIR_RECEIVE_TIMEOUT:
+            i686_inb(UART_DATA);
+            break;
+
+        case IIR_LINE_STATUS:
+            i686_inb(UART_LINE_STATUS);
+            break;
+
+        case IIR_MODEM_STATUS:
+            i686_inb(UART_MODEM_STATUS);
+            break;
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "stdtypes.h"
+
+Bool serialInitialize();
+void serialWrite(char c);
+void serialFlush();
+Uint32 serialGetDropped();
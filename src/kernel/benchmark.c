@@ -0,0 +1,199 @@
+#include "benchmark.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "memory.h"
+#include "arch/i686/io.h"
+#include "arch/i686/irq.h"
+#include "arch/i686/pic.h"
+
+/*
+ * Microbenchmark for the memory primitives
+ *
+ * Each memcpy and memset implementation is timed with rdtsc at every power of two size from 16B to 8MB
+ * Small sizes are repeated so that every measurement moves about the same number of bytes
+ * and the result is reported as cycles per KB, so the implementations and sizes can be compared directly
+ *
+ * The buffers are fixed physical addresses well above the kernel and initrd,
+ * so the machine needs at least 48MB of RAM (QEMU gives 128MB by default)
+ */
+
+#define BENCHMARK_SOURCE        ((Uint8*) 0x2000000)
+#define BENCHMARK_DESTINATION   ((Uint8*) 0x2800000)
+#define BENCHMARK_MIN_SIZE      16
+#define BENCHMARK_MAX_SIZE      0x800000
+#define BENCHMARK_BYTES         0x1000000   // Bytes moved per measurement
+
+/*
+ * Microbenchmark for interrupt entry
+ *
+ * Raises the vector of an unused IRQ with an int instruction, which goes through the same
+ * IDT gate, stub, handler and EOI as the real thing, minus the PIC's own delivery
+ *
+ * Three paths are compared: the direct stub in irq.asm, the generic path through isr_common
+ * as it is now, and the generic path as it was before the direct stubs, when irqCommonHandler
+ * passed the register frame to the device handler and always ended the interrupt at the PIC
+ * The last is rebuilt here as benchmark_legacyCommonHandler
+ * That many interrupts in a tick would look like a storm, so storm detection is suspended for the line
+ */
+
+#define BENCHMARK_IRQ           5           // LPT2. Nothing drives it under QEMU
+#define BENCHMARK_INTERRUPTS    100000
+
+/*
+ * Forward declarations
+ */
+
+void benchmark_memcpy(const char* name, MemcpyFn fn);
+void benchmark_memset(const char* name, MemsetFn fn);
+void benchmark_report(const char* name, Uint32 size, Uint64 cycles, Uint32 repeats);
+Uint64 benchmark_interrupts();
+void benchmark_emptyIRQ(int irq);
+void benchmark_legacyCommonHandler(ISRRegisters* regs);
+void benchmark_legacyEmptyIRQ(ISRRegisters* regs);
+
+typedef void (*LegacyIRQHandler)(ISRRegisters* regs);
+
+LegacyIRQHandler benchmarkLegacyHandlers[MAX_NUM_IRQS];
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Compare the byte, rep movs/stos, ERMS and (if withSSE2) SSE2 implementations of memcpy and memset
+ *
+ * Only pass withSSE2 = true once SSE has been enabled, otherwise the first SSE2 instruction faults
+ */
+void benchmarkMemory(Bool withSSE2)
+{
+    printf("benchmarkMemory: %u - %u bytes, cycles/KB\n", BENCHMARK_MIN_SIZE, BENCHMARK_MAX_SIZE);
+
+    // Touch both buffers once so the first measurement doesn't pay for anything the rest don't
+    memsetRep(BENCHMARK_SOURCE, 0x5A, BENCHMARK_MAX_SIZE);
+    memsetRep(BENCHMARK_DESTINATION, 0, BENCHMARK_MAX_SIZE);
+
+    benchmark_memcpy("memcpyBytes", memcpyBytes);
+    benchmark_memcpy("memcpyRep", memcpyRep);
+    benchmark_memcpy("memcpyERMS", memcpyERMS);
+    if (withSSE2) {
+        benchmark_memcpy("memcpySSE2", memcpySSE2);
+    }
+
+    benchmark_memset("memsetBytes", memsetBytes);
+    benchmark_memset("memsetRep", memsetRep);
+    benchmark_memset("memsetERMS", memsetERMS);
+    if (withSSE2) {
+        benchmark_memset("memsetSSE2", memsetSSE2);
+    }
+}
+
+/*
+ * Compare the round trip of an IRQ through its direct stub with the generic isr_common path
+ */
+void benchmarkInterrupts()
+{
+    printf("benchmarkInterrupts: %u round trips, cycles each\n", BENCHMARK_INTERRUPTS);
+
+    // The line stays masked. The int instruction doesn't care
+    irqRegisterHandler(BENCHMARK_IRQ, benchmark_emptyIRQ);
+    irqMask(BENCHMARK_IRQ);
+    irqTrackStorms(BENCHMARK_IRQ, false);
+
+    Uint64 direct = benchmark_interrupts();
+
+    irqSetDirect(BENCHMARK_IRQ, false);
+    Uint64 generic = benchmark_interrupts();
+
+    benchmarkLegacyHandlers[BENCHMARK_IRQ] = benchmark_legacyEmptyIRQ;
+    isrRegisterHandler(PIC_BASE_IVN + BENCHMARK_IRQ, benchmark_legacyCommonHandler);
+    Uint64 legacy = benchmark_interrupts();
+    isrRegisterHandler(PIC_BASE_IVN + BENCHMARK_IRQ, irqCommonHandler);
+
+    irqSetDirect(BENCHMARK_IRQ, true);
+    irqTrackStorms(BENCHMARK_IRQ, true);
+
+    printf("  direct: %llu\n", direct / BENCHMARK_INTERRUPTS);
+    printf("  generic: %llu\n", generic / BENCHMARK_INTERRUPTS);
+    printf("  before direct stubs: %llu\n", legacy / BENCHMARK_INTERRUPTS);
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+void benchmark_memcpy(const char* name, MemcpyFn fn)
+{
+    for (Uint32 size = BENCHMARK_MIN_SIZE; size <= BENCHMARK_MAX_SIZE; size <<= 1) {
+        Uint32 repeats = BENCHMARK_BYTES / size;
+
+        Uint64 start = i686_rdtsc();
+        for (Uint32 ii = 0; ii < repeats; ++ii) {
+            fn(BENCHMARK_DESTINATION, BENCHMARK_SOURCE, size);
+        }
+        benchmark_report(name, size, i686_rdtsc() - start, repeats);
+    }
+}
+
+void benchmark_memset(const char* name, MemsetFn fn)
+{
+    for (Uint32 size = BENCHMARK_MIN_SIZE; size <= BENCHMARK_MAX_SIZE; size <<= 1) {
+        Uint32 repeats = BENCHMARK_BYTES / size;
+
+        Uint64 start = i686_rdtsc();
+        for (Uint32 ii = 0; ii < repeats; ++ii) {
+            fn(BENCHMARK_DESTINATION, 0xA5, size);
+        }
+        benchmark_report(name, size, i686_rdtsc() - start, repeats);
+    }
+}
+
+void benchmark_report(const char* name, Uint32 size, Uint64 cycles, Uint32 repeats)
+{
+    Uint64 kb = ((Uint64) size * repeats) >> 10;
+
+    printf("  %s %u: %llu\n", name, size, cycles / kb);
+}
+
+/*
+ * Cycles for BENCHMARK_INTERRUPTS round trips through the IRQ's current entry path
+ *
+ * Interrupts are off so a timer tick doesn't land in the middle of the measurement
+ */
+Uint64 benchmark_interrupts()
+{
+    Uint32 flags = i686_disableInterruptsSave();
+
+    Uint64 start = i686_rdtsc();
+    for (Uint32 ii = 0; ii < BENCHMARK_INTERRUPTS; ++ii) {
+        __asm__ __volatile__("int %0" : : "i" (PIC_BASE_IVN + BENCHMARK_IRQ) : "memory");
+    }
+    Uint64 cycles = i686_rdtsc() - start;
+
+    i686_restoreInterrupts(flags);
+
+    return cycles;
+}
+
+void benchmark_emptyIRQ(int irq)
+{
+}
+
+/*
+ * irqCommonHandler as it was before the direct stubs
+ */
+void benchmark_legacyCommonHandler(ISRRegisters* regs)
+{
+    int irq = regs->vectorNumber - PIC_BASE_IVN;
+
+    if (benchmarkLegacyHandlers[irq] != NULL) {
+        benchmarkLegacyHandlers[irq](regs);
+    } else {
+        printf("Unhandled IRQ %d, ISR = %x, IRR = %x\n", irq, picGetISR(), picGetIRR());
+    }
+
+    picSendEndOfInterrupt(irq);
+}
+
+void benchmark_legacyEmptyIRQ(ISRRegisters* regs)
+{
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "stdtypes.h"
+
+void benchmarkMemory(Bool withSSE2);
+void benchmarkInterrupts();
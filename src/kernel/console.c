@@ -0,0 +1,225 @@
+#include "console.h"
+#include "stdtypes.h"
+#include "string.h"
+#include "arch/i686/io.h"
+
+/*
+ * VGA text mode console
+ *
+ * https://wiki.osdev.org/Text_Mode_Cursor
+ * http://www.osdever.net/FreeVGA/vga/crtcreg.htm
+ *
+ * Video memory is slow to access, so characters are written to a shadow copy of the screen in RAM
+ * and consoleFlush copies just the rows that changed across in one go, then moves the cursor
+ * stdio flushes once per printf, so the cursor's four port writes happen per call rather than per character
+ *
+ * The screen is a window onto the 32KB of text mode video memory at 0xB8000, which holds 204 rows
+ * The CRTC Start Address registers say which cell is at the top left of the window
+ * To scroll we move the window down a row instead of copying the screen up, and only the new bottom row
+ * needs writing. When the window reaches the end of video memory it moves back to the start
+ * and the whole screen is redrawn from the shadow, once every 179 lines
+ *
+ * The shadow is a ring of rows too: shadowTop is the shadow row at the top of the screen
+ *
+ * consoleWrite must be called with interrupts off. consoleFlush turns them off for each step, one row or one
+ * CRTC update, and lets them in between, so it can be called with them on. Output from an interrupt handler
+ * that arrives while a flush is running goes into the shadow, and the interrupted flush copies it
+ */
+
+#define SCREEN_WIDTH                80          // As defined by VGA
+#define SCREEN_HEIGHT               25
+#define DEFAULT_COLOR               0x0F        // White (F) on black (0)
+#define TAB_WIDTH                   4
+
+#define VIDEO_MEMORY                ((Uint16*) 0xB8000)
+#define VIDEO_MEMORY_ROWS           (0x8000 / (SCREEN_WIDTH * 2))
+
+#define CRTC_INDEX_PORT             0x3D4
+#define CRTC_DATA_PORT              0x3D5
+#define CRTC_START_ADDRESS_HIGH     0x0C
+#define CRTC_START_ADDRESS_LOW      0x0D
+#define CRTC_CURSOR_LOCATION_HIGH   0x0E
+#define CRTC_CURSOR_LOCATION_LOW    0x0F
+
+#define BLANK                       ((DEFAULT_COLOR << 8) | ' ')
+#define ALL_ROWS                    ((1 << SCREEN_HEIGHT) - 1)
+
+typedef struct {
+    Uint16  shadow[SCREEN_HEIGHT][SCREEN_WIDTH];    // Character in the low byte, color in the high byte
+    Uint32  shadowTop;          // Shadow row shown at the top of the screen
+    Uint32  videoTop;           // Video memory row shown at the top of the screen
+    Uint32  dirtyRows;          // Bit n set if screen row n differs from video memory
+    Bool    windowMoved;        // videoTop has changed since the last flush
+    Bool    cursorMoved;        // x or y has changed since the last flush
+    Bool    flushing;           // consoleFlush is running, maybe interrupted
+    int     x, y;               // Cursor
+} Console;
+
+Console console;
+
+/*
+ * Forward declarations
+ */
+
+Uint16* console_row(int y);
+int console_firstDirtyRow();
+void console_newLine();
+void console_writeCRTC(Uint8 index, Uint16 value);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+void consoleClear()
+{
+    for (int yy = 0; yy < SCREEN_HEIGHT; ++yy) {
+        for (int xx = 0; xx < SCREEN_WIDTH; ++xx) {
+            console.shadow[yy][xx] = BLANK;
+        }
+    }
+
+    console.shadowTop = 0;
+    console.videoTop = 0;
+    console.dirtyRows = ALL_ROWS;
+    console.windowMoved = true;
+    console.cursorMoved = true;
+    console.x = 0;
+    console.y = 0;
+
+    consoleFlush();
+}
+
+/*
+ * Write c at the cursor in the shadow. Nothing reaches the screen until consoleFlush
+ */
+void consoleWrite(char c)
+{
+    console.cursorMoved = true;
+
+    switch (c) {
+    case '\n':
+        console_newLine();
+        break;
+
+    case '\r':
+        console.x = 0;
+        break;
+
+    case '\t':
+        for (int spaces = TAB_WIDTH - (console.x % TAB_WIDTH); spaces > 0; --spaces) {
+            consoleWrite(' ');
+        }
+        break;
+
+    default:
+        console_row(console.y)[console.x] = (DEFAULT_COLOR << 8) | (Uint8) c;
+        console.dirtyRows |= 1 << console.y;
+        if (++console.x >= SCREEN_WIDTH) {
+            console_newLine();
+        }
+        break;
+    }
+}
+
+/*
+ * Copy the rows that changed to video memory, then move the window and the cursor
+ */
+void consoleFlush()
+{
+    Uint32 flags = i686_disableInterruptsSave();
+
+    // An interrupt handler's output during a flush is left to the flush it interrupted
+    if (console.flushing) {
+        i686_restoreInterrupts(flags);
+        return;
+    }
+    console.flushing = true;
+
+    for (;;) {
+        int yy = console_firstDirtyRow();
+
+        if (yy < SCREEN_HEIGHT) {
+            memcpy(VIDEO_MEMORY + (console.videoTop + yy) * SCREEN_WIDTH, console_row(yy), SCREEN_WIDTH * sizeof(Uint16));
+            console.dirtyRows &= ~(1 << yy);
+        } else if (console.windowMoved) {
+            // Only once the rows are in place, so the window never shows a stale row
+            console_writeCRTC(CRTC_START_ADDRESS_HIGH, console.videoTop * SCREEN_WIDTH);
+            console.windowMoved = false;
+        } else if (console.cursorMoved) {
+            console_writeCRTC(CRTC_CURSOR_LOCATION_HIGH, (console.videoTop + console.y) * SCREEN_WIDTH + console.x);
+            console.cursorMoved = false;
+        } else {
+            break;
+        }
+
+        i686_restoreInterrupts(flags);
+        flags = i686_disableInterruptsSave();
+    }
+
+    console.flushing = false;
+    i686_restoreInterrupts(flags);
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * The shadow row for screen row y
+ */
+Uint16* console_row(int y)
+{
+    return console.shadow[(console.shadowTop + y) % SCREEN_HEIGHT];
+}
+
+/*
+ * The first screen row that differs from video memory, or SCREEN_HEIGHT if none do
+ */
+int console_firstDirtyRow()
+{
+    int yy = 0;
+    while (yy < SCREEN_HEIGHT && (console.dirtyRows & (1 << yy)) == 0) {
+        ++yy;
+    }
+    return yy;
+}
+
+/*
+ * Move the cursor to the start of the next line, scrolling if it was on the bottom line
+ */
+void console_newLine()
+{
+    console.x = 0;
+    if (++console.y < SCREEN_HEIGHT) {
+        return;
+    }
+
+    // The old top row becomes the new, blank, bottom row
+    console.y = SCREEN_HEIGHT - 1;
+    console.shadowTop = (console.shadowTop + 1) % SCREEN_HEIGHT;
+    Uint16* bottom = console_row(console.y);
+    for (int xx = 0; xx < SCREEN_WIDTH; ++xx) {
+        bottom[xx] = BLANK;
+    }
+
+    // Rows already in video memory stay put and the window slides down over them,
+    // so every row still to be flushed now sits one screen row higher
+    console.dirtyRows = (console.dirtyRows >> 1) | (1 << console.y);
+    console.windowMoved = true;
+
+    if (++console.videoTop + SCREEN_HEIGHT > VIDEO_MEMORY_ROWS) {
+        console.videoTop = 0;
+        console.dirtyRows = ALL_ROWS;
+    }
+}
+
+/*
+ * Write a 16 bit CRTC value: the high byte to register index and the low byte to index + 1
+ */
+void console_writeCRTC(Uint8 index, Uint16 value)
+{
+    i686_outb(CRTC_INDEX_PORT, index);
+    i686_outb(CRTC_DATA_PORT, value >> 8);
+    i686_outb(CRTC_INDEX_PORT, index + 1);
+    i686_outb(CRTC_DATA_PORT, value & 0xFF);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "stdtypes.h"
+
+void consoleClear();
+void consoleWrite(char c);
+void consoleFlush();
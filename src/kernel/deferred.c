@@ -0,0 +1,154 @@
+#include "deferred.h"
+#include "stdtypes.h"
+#include "arch/i686/io.h"
+
+/*
+ * Deferred work, the "bottom half" of interrupt handling
+ *
+ * An interrupt handler does only what has to be done with interrupts off, such as acknowledging
+ * the device, and queues the rest with deferredQueue. The IRQ entry path runs up to DEFERRED_IRQ_BATCH
+ * queued items after the EOI, with interrupts back on, before it returns from the interrupt
+ * Anything still queued after that is picked up by the idle loop
+ *
+ * The queue is a bounded ring of slots, each with a sequence number (Dmitry Vyukov's bounded queue)
+ * Any number of producers, which may interrupt one another, claim a slot by advancing head with
+ * cmpxchg, fill it in, and publish it by setting its sequence. There is a single consumer at a time,
+ * which deferredRun ensures, so tail needs no atomics. Nothing ever waits with interrupts off
+ *
+ * Slot i holds position p when its sequence is p: it is free for a producer. When its sequence
+ * is p + 1 it has been published and the consumer may take it. The consumer then sets it to
+ * p + DEFERRED_RING_SIZE, freeing it for the producer that comes round to it next time
+ *
+ * If the ring is full the work is dropped and counted, rather than making an interrupt handler wait
+ */
+
+#define DEFERRED_RING_SIZE      256     // Must be a power of two
+
+typedef struct {
+    volatile Uint32 sequence;
+    DeferredFn      fn;
+    void*           context;
+} DeferredSlot;
+
+typedef struct {
+    DeferredSlot    ring[DEFERRED_RING_SIZE];
+    volatile Uint32 head;           // Next position for a producer
+    Uint32          tail;           // Next position for the consumer
+    volatile Bool   running;        // deferredRun is consuming
+    volatile Uint32 dropped;
+} Deferred;
+
+Deferred deferred;
+
+// Stops the compiler moving memory accesses across it. x86 doesn't reorder stores with stores
+// or loads with loads, so that is all publishing a slot needs
+#define DEFERRED_BARRIER() __asm__ __volatile__("" : : : "memory")
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Number the slots. The .bss starts them all at zero, which is only right for slot 0
+ * Must be called before interrupts are enabled
+ */
+void deferredInitialize()
+{
+    for (Uint32 ii = 0; ii < DEFERRED_RING_SIZE; ++ii) {
+        deferred.ring[ii].sequence = ii;
+    }
+}
+
+/*
+ * Queue fn(context) to run later with interrupts enabled. Safe to call from an interrupt handler
+ *
+ * Returns false if the queue is full, in which case fn won't be called
+ */
+Bool deferredQueue(DeferredFn fn, void* context)
+{
+    Uint32 position = deferred.head;
+
+    for (;;) {
+        DeferredSlot* slot = &deferred.ring[position & (DEFERRED_RING_SIZE - 1)];
+        Int32 diff = (Int32) (slot->sequence - position);
+
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&deferred.head, position, position + 1)) {
+                slot->fn = fn;
+                slot->context = context;
+                DEFERRED_BARRIER();
+                slot->sequence = position + 1;
+                return true;
+            }
+            position = deferred.head;
+
+        } else if (diff < 0) {
+            // The consumer hasn't freed this slot since the last time round
+            __sync_fetch_and_add(&deferred.dropped, 1);
+            return false;
+
+        } else {
+            // Another producer claimed it first
+            position = deferred.head;
+        }
+    }
+}
+
+/*
+ * Run up to budget queued work items, oldest first, with interrupts as the caller has them
+ *
+ * Returns whether work is still queued. If another deferredRun is already consuming, e.g. the idle
+ * loop was interrupted in the middle of one, returns straight away and leaves the work to it
+ */
+Bool deferredRun(Uint32 budget)
+{
+    Uint32 flags = i686_disableInterruptsSave();
+    if (deferred.running) {
+        i686_restoreInterrupts(flags);
+        return deferredPending();
+    }
+    deferred.running = true;
+    i686_restoreInterrupts(flags);
+
+    for (Uint32 ii = 0; ii < budget; ++ii) {
+        DeferredSlot* slot = &deferred.ring[deferred.tail & (DEFERRED_RING_SIZE - 1)];
+        if (slot->sequence != deferred.tail + 1) {
+            break;      // Not published yet
+        }
+
+        DeferredFn fn = slot->fn;
+        void* context = slot->context;
+        DEFERRED_BARRIER();
+        slot->sequence = deferred.tail + DEFERRED_RING_SIZE;
+        ++deferred.tail;
+
+        fn(context);
+    }
+
+    deferred.running = false;
+
+    // Checked after running is cleared, so work queued by an interrupt that found us
+    // running is either reported here or run by that interrupt's successor
+    return deferredPending();
+}
+
+/*
+ * Whether anything has been queued that hasn't been taken to run yet
+ */
+Bool deferredPending()
+{
+    return deferred.head != deferred.tail;
+}
+
+/*
+ * Whether a deferredRun is consuming, perhaps further down the stack
+ */
+Bool deferredRunning()
+{
+    return deferred.running;
+}
+
+Uint32 deferredGetDropped()
+{
+    return deferred.dropped;
+}
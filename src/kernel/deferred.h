@@ -0,0 +1,14 @@
+#pragma once
+
+#include "stdtypes.h"
+
+#define DEFERRED_IRQ_BATCH      8       // Most work items run on the way out of one interrupt
+
+typedef void (*DeferredFn)(void* context);
+
+void deferredInitialize();
+Bool deferredQueue(DeferredFn fn, void* context);
+Bool deferredRun(Uint32 budget);
+Bool deferredPending();
+Bool deferredRunning();
+Uint32 deferredGetDropped();
@@ -3,11 +3,15 @@
 #include <arch/i686/idt.h>
 #include <arch/i686/isr.h>
 #include <arch/i686/irq.h>
+#include <arch/i686/cpu.h>
+#include <arch/i686/serial.h>
 
 void halInitialize()
 {
+    cpuInitialize();
     gdtInitialize();
     idtInitialize();
     isrInitialize();
     irqInitialize();
+    serialInitialize();
 }
@@ -0,0 +1,264 @@
+#include "initrd.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "string.h"
+
+/*
+ * Initial ramdisk
+ *
+ * Stage2 loads initrd.cpio into memory and hands us its address and size
+ * The archive is in the "new ASCII" (newc) cpio format as produced by
+ *      find . | cpio -o -H newc
+ *
+ * Each member is a 110 byte ASCII header, the null terminated name, and then the file body
+ * The header + name and the body are each padded to a multiple of 4 bytes
+ * The archive ends with a member named "TRAILER!!!"
+ *
+ * https://man.archlinux.org/man/cpio.5#New_ASCII_Format
+ *
+ * We walk the archive once, front to back, and build an index of the members in place
+ * Names and bodies are left where they are in the archive and the index points at them
+ * Lookups hash the path and probe a single bucket
+ */
+
+#define CPIO_NEWC_MAGIC         "070701"
+#define CPIO_MAGIC_LENGTH       6
+#define CPIO_TRAILER            "TRAILER!!!"
+#define CPIO_ALIGNMENT          4
+
+#define INITRD_MAX_FILES        256
+#define INITRD_NUM_BUCKETS      512     // Must be a power of two
+#define INITRD_NO_FILE          0xFFFF
+
+typedef struct {
+    char    magic[6];
+    char    inode[8];
+    char    mode[8];
+    char    userID[8];
+    char    groupID[8];
+    char    numLinks[8];
+    char    modTime[8];
+    char    fileSize[8];
+    char    devMajor[8];
+    char    devMinor[8];
+    char    rdevMajor[8];
+    char    rdevMinor[8];
+    char    nameSize[8];    // Includes the terminating null
+    char    check[8];
+} __attribute__((packed)) CpioHeader;
+
+typedef struct {
+    const Uint8*    base;
+    Uint32          size;
+    Uint16          numFiles;
+    InitrdFile      files[INITRD_MAX_FILES];
+    Uint16          buckets[INITRD_NUM_BUCKETS];
+} InitrdData;
+
+InitrdData initrd;
+
+/*
+ * Forward declarations
+ */
+
+Bool        initrd_parseHex(const char* field, Uint32* value);
+Uint32      initrd_hash(const char* name, Uint16 length);
+const char* initrd_normalize(const char* name, Uint16* length);
+Uint32      initrd_align(Uint32 offset);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Index the cpio archive at base
+ *
+ * Returns false if the archive is malformed. Members found before the problem remain indexed
+ */
+Bool initrdInitialize(void* base, Uint32 size)
+{
+    initrd.base = base;
+    initrd.size = size;
+    initrd.numFiles = 0;
+
+    for (int ii = 0; ii < INITRD_NUM_BUCKETS; ++ii) {
+        initrd.buckets[ii] = INITRD_NO_FILE;
+    }
+
+    Uint32 offset = 0;
+    for (;;) {
+        if (offset + sizeof(CpioHeader) > size) {
+            printf("initrd: Archive truncated at %#x\n", offset);
+            return false;
+        }
+
+        const CpioHeader* header = (const CpioHeader*) (initrd.base + offset);
+        if (memcmp(header->magic, CPIO_NEWC_MAGIC, CPIO_MAGIC_LENGTH) != 0) {
+            printf("initrd: Bad magic at %#x. Expected a newc cpio archive\n", offset);
+            return false;
+        }
+
+        Uint32 mode, fileSize, nameSize;
+        if (!initrd_parseHex(header->mode, &mode)
+         || !initrd_parseHex(header->fileSize, &fileSize)
+         || !initrd_parseHex(header->nameSize, &nameSize)) {
+            printf("initrd: Bad header at %#x\n", offset);
+            return false;
+        }
+
+        Uint32 nameOffset = offset + sizeof(CpioHeader);
+        Uint32 dataOffset = initrd_align(nameOffset + nameSize);
+        if (nameSize == 0 || dataOffset > size || fileSize > size - dataOffset) {
+            printf("initrd: Member at %#x runs past the end of the archive\n", offset);
+            return false;
+        }
+
+        const char* name = (const char*) (initrd.base + nameOffset);
+        if (nameSize == sizeof(CPIO_TRAILER) && memcmp(name, CPIO_TRAILER, sizeof(CPIO_TRAILER)) == 0) {
+            break;
+        }
+
+        Uint16 length = nameSize - 1;
+        name = initrd_normalize(name, &length);
+
+        if (length > 0) {
+            if (initrd.numFiles == INITRD_MAX_FILES) {
+                printf("initrd: Too many files. Ignoring '%s' and anything after it\n", name);
+                return false;
+            }
+
+            Uint16 index = initrd.numFiles++;
+            InitrdFile* file = &initrd.files[index];
+            file->name = name;
+            file->nameLength = length;
+            file->hash = initrd_hash(name, length);
+            file->mode = mode;
+            file->size = fileSize;
+            file->data = initrd.base + dataOffset;
+
+            Uint32 bucket = file->hash & (INITRD_NUM_BUCKETS - 1);
+            file->next = initrd.buckets[bucket];
+            initrd.buckets[bucket] = index;
+        }
+
+        offset = initrd_align(dataOffset + fileSize);
+    }
+
+    return true;
+}
+
+/*
+ * Find a file or directory by its path within the archive, e.g. "/etc/hostname"
+ *
+ * Returns NULL if there is no such member
+ */
+const InitrdFile* initrdFind(const char* path)
+{
+    if (path == NULL) {
+        return NULL;
+    }
+
+    Uint16 length = strlen(path);
+    path = initrd_normalize(path, &length);
+
+    Uint32 hash = initrd_hash(path, length);
+    Uint16 index = initrd.buckets[hash & (INITRD_NUM_BUCKETS - 1)];
+
+    while (index != INITRD_NO_FILE) {
+        const InitrdFile* file = &initrd.files[index];
+        if (file->hash == hash && file->nameLength == length && memcmp(file->name, path, length) == 0) {
+            return file;
+        }
+        index = file->next;
+    }
+
+    return NULL;
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+Bool initrd_parseHex(const char* field, Uint32* value)
+{
+    Uint32 result = 0;
+
+    for (int ii = 0; ii < 8; ++ii) {
+        char chr = field[ii];
+        Uint32 digit;
+
+        if (chr >= '0' && chr <= '9') {
+            digit = chr - '0';
+        } else if (chr >= 'a' && chr <= 'f') {
+            digit = chr - 'a' + 10;
+        } else if (chr >= 'A' && chr <= 'F') {
+            digit = chr - 'A' + 10;
+        } else {
+            return false;
+        }
+
+        result = (result << 4) | digit;
+    }
+
+    *value = result;
+    return true;
+}
+
+/*
+ * 32 bit FNV-1a
+ */
+Uint32 initrd_hash(const char* name, Uint16 length)
+{
+    Uint32 hash = 0x811C9DC5;
+
+    for (Uint16 ii = 0; ii < length; ++ii) {
+        hash ^= (Uint8) name[ii];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/*
+ * Strip any leading "./" and "/" so that "./etc/hostname", "/etc/hostname" and "etc/hostname"
+ * all refer to the same member. The archive root "." becomes the empty name
+ */
+const char* initrd_normalize(const char* name, Uint16* length)
+{
+    for (;;) {
+        if (*length >= 2 && name[0] == '.' && name[1] == '/') {
+            name += 2;
+            *length -= 2;
+        } else if (*length >= 1 && name[0] == '/') {
+            name++;
+            *length -= 1;
+        } else if (*length == 1 && name[0] == '.') {
+            name++;
+            *length = 0;
+        } else {
+            return name;
+        }
+    }
+}
+
+Uint32 initrd_align(Uint32 offset)
+{
+    return (offset + CPIO_ALIGNMENT - 1) & ~(CPIO_ALIGNMENT - 1);
+}
+
+// ###############################################
+//      Debugging functions
+// ###############################################
+
+void initrdPrint()
+{
+    printf("initrd @ %p: size = %u, files = %u\n", initrd.base, initrd.size, initrd.numFiles);
+
+    for (Uint16 ii = 0; ii < initrd.numFiles; ++ii) {
+        InitrdFile* file = &initrd.files[ii];
+        printf("  %s%s  size = %u\n",
+            file->name,
+            (file->mode & INITRD_MODE_TYPE_MASK) == INITRD_MODE_DIR ? "/" : "",
+            file->size);
+    }
+}
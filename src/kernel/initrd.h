@@ -0,0 +1,27 @@
+#pragma once
+
+#include "stdtypes.h"
+
+#define INITRD_MODE_TYPE_MASK   0170000
+#define INITRD_MODE_DIR         0040000
+#define INITRD_MODE_FILE        0100000
+
+/*
+ * One indexed member of the initial ramdisk
+ *
+ * name and data point into the archive itself. Nothing is copied out of it,
+ * so the archive memory must stay put for as long as the kernel uses the ramdisk
+ */
+typedef struct {
+    const char*  name;          // Null terminated. Leading "./" or "/" stripped
+    Uint16       nameLength;
+    Uint16       next;          // Next file in the same hash bucket
+    Uint32       hash;
+    Uint32       mode;
+    Uint32       size;
+    const Uint8* data;
+} InitrdFile;
+
+Bool initrdInitialize(void* base, Uint32 size);
+const InitrdFile* initrdFind(const char* path);
+void initrdPrint();
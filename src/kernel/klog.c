@@ -0,0 +1,236 @@
+#include "klog.h"
+#include "stdtypes.h"
+#include "stdio.h"
+#include "format.h"
+#include "string.h"
+#include "arch/i686/io.h"
+#include "arch/i686/clock.h"
+
+/*
+ * Kernel log
+ *
+ * klog formats a message and appends it to a fixed size ring of binary records, each stamped with
+ * the clock and a sequence number. It never touches the console, so it costs about the same in an
+ * interrupt handler as anywhere else: the formatting, then a copy into the ring with interrupts off
+ *
+ * klogFlush renders the records that haven't been shown yet to the console and serial port
+ * It is called from the kernel's idle loop, outside interrupt context
+ * klogDump renders everything still in the ring, e.g. after a panic
+ *
+ * Records are stored whole: one that won't fit before the end of the ring is preceded by a padding
+ * record to the end and starts again at the beginning. When the ring is full the oldest records are
+ * overwritten. If that includes records klogFlush hasn't shown yet, it says how many were lost
+ *
+ * Positions in the ring only ever increase and are reduced modulo the ring size to find the bytes,
+ * so head - tail is always the number of bytes in use, even after the positions wrap
+ */
+
+#define KLOG_RING_SIZE          0x4000      // Must be a power of two
+#define KLOG_MAX_MESSAGE        255
+#define KLOG_ALIGNMENT          4           // Records start on a 4 byte boundary, so a padding record's size always fits
+#define KLOG_PADDING            0           // Level of a padding record
+#define MICROSECONDS            1000000
+
+typedef struct {
+    Uint16  size;               // Of the whole record including this header, rounded up to KLOG_ALIGNMENT
+    Uint8   level;              // KLOG_PADDING for a padding record, which has nothing after size and level
+    Uint8   length;             // Of the text that follows. Not null terminated
+    Uint32  sequence;
+    Uint64  timestamp;          // clockRead ticks
+} KLogRecord;
+
+typedef struct {
+    Uint8   ring[KLOG_RING_SIZE];
+    Uint32  head;               // Where the next record goes
+    Uint32  tail;               // Oldest record still in the ring
+    Uint32  readPosition;       // Next record for klogFlush
+    Uint32  sequence;
+    Uint32  lost;               // Records overwritten before klogFlush got to them
+} KLog;
+
+KLog klogData;
+
+/*
+ * Forward declarations
+ */
+
+void klog_append(KLogLevel level, const char* text, Uint32 length);
+void klog_makeRoom(Uint32 size);
+Bool klog_read(Uint32* position, KLogRecord* record, char* text);
+void klog_render(KLogRecord* record, char* text);
+Uint32 klog_align(Uint32 size);
+
+// ###############################################
+//      Public functions
+// ###############################################
+
+/*
+ * Add a printf style message to the log. Safe to call from an interrupt handler
+ *
+ * Messages are truncated to KLOG_MAX_MESSAGE characters. A trailing newline is dropped
+ */
+void klog(KLogLevel level, const char* fmt, ...)
+{
+    char buff[KLOG_MAX_MESSAGE + 1];
+
+    va_list args;
+    va_start(args, fmt);
+    Uint32 length = vsnprintf(buff, sizeof(buff), fmt, args);
+    va_end(args);
+
+    if (length > KLOG_MAX_MESSAGE) {
+        length = KLOG_MAX_MESSAGE;
+    }
+    if (length > 0 && buff[length - 1] == '\n') {
+        --length;
+    }
+
+    Uint32 flags = i686_disableInterruptsSave();
+    klog_append(level, buff, length);
+    i686_restoreInterrupts(flags);
+}
+
+/*
+ * Render the records added since the last call
+ */
+void klogFlush()
+{
+    KLogRecord record;
+    char text[KLOG_MAX_MESSAGE + 1];
+
+    for (;;) {
+        Uint32 flags = i686_disableInterruptsSave();
+        Uint32 lost = klogData.lost;
+        klogData.lost = 0;
+        Bool found = klog_read(&klogData.readPosition, &record, text);
+        i686_restoreInterrupts(flags);
+
+        if (lost > 0) {
+            printf("klog: %u messages lost\n", lost);
+        }
+        if (!found) {
+            break;
+        }
+        klog_render(&record, text);
+    }
+}
+
+/*
+ * Render every record still in the ring, whether or not it has been shown before
+ */
+void klogDump()
+{
+    KLogRecord record;
+    char text[KLOG_MAX_MESSAGE + 1];
+
+    printf("klog: dump\n");
+
+    Uint32 position = klogData.tail;
+    for (;;) {
+        Uint32 flags = i686_disableInterruptsSave();
+        if ((Int32) (position - klogData.tail) < 0) {
+            position = klogData.tail;   // Overwritten while we were rendering
+        }
+        Bool found = klog_read(&position, &record, text);
+        i686_restoreInterrupts(flags);
+
+        if (!found) {
+            break;
+        }
+        klog_render(&record, text);
+    }
+}
+
+// ###############################################
+//      Private functions
+// ###############################################
+
+/*
+ * Copy a record into the ring. Interrupts must be off
+ */
+void klog_append(KLogLevel level, const char* text, Uint32 length)
+{
+    Uint32 size = klog_align(sizeof(KLogRecord) + length);
+    Uint32 offset = klogData.head & (KLOG_RING_SIZE - 1);
+
+    if (offset + size > KLOG_RING_SIZE) {
+        Uint32 padding = KLOG_RING_SIZE - offset;
+        klog_makeRoom(padding);
+        KLogRecord* pad = (KLogRecord*) &klogData.ring[offset];
+        pad->size = padding;
+        pad->level = KLOG_PADDING;
+        klogData.head += padding;
+        offset = 0;
+    }
+
+    klog_makeRoom(size);
+
+    KLogRecord* record = (KLogRecord*) &klogData.ring[offset];
+    record->size = size;
+    record->level = level;
+    record->length = length;
+    record->sequence = klogData.sequence++;
+    record->timestamp = clockRead();
+    memcpy(record + 1, text, length);
+
+    klogData.head += size;
+}
+
+/*
+ * Drop the oldest records until there are size free bytes
+ */
+void klog_makeRoom(Uint32 size)
+{
+    while (klogData.head + size - klogData.tail > KLOG_RING_SIZE) {
+        KLogRecord* oldest = (KLogRecord*) &klogData.ring[klogData.tail & (KLOG_RING_SIZE - 1)];
+
+        if (klogData.readPosition == klogData.tail) {
+            klogData.readPosition += oldest->size;
+            if (oldest->level != KLOG_PADDING) {
+                ++klogData.lost;
+            }
+        }
+        klogData.tail += oldest->size;
+    }
+}
+
+/*
+ * Copy the record at *position, skipping padding, and move *position past it
+ *
+ * Returns false if there are no more records. Interrupts must be off
+ */
+Bool klog_read(Uint32* position, KLogRecord* record, char* text)
+{
+    while (*position != klogData.head) {
+        KLogRecord* next = (KLogRecord*) &klogData.ring[*position & (KLOG_RING_SIZE - 1)];
+        *position += next->size;
+
+        if (next->level != KLOG_PADDING) {
+            *record = *next;
+            memcpy(text, next + 1, next->length);
+            text[next->length] = '\0';
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Print a record as [seconds.microseconds] level: text
+ */
+void klog_render(KLogRecord* record, char* text)
+{
+    static const char* levelNames[] = { "", "error: ", "warning: ", "", "debug: " };
+
+    Uint64 frequency = clockGetFrequency();
+    Uint64 seconds = record->timestamp / frequency;
+    Uint32 microseconds = (record->timestamp % frequency) * MICROSECONDS / frequency;
+
+    printf("[%llu.%06u] %s%s\n", seconds, microseconds, levelNames[record->level], text);
+}
+
+Uint32 klog_align(Uint32 size)
+{
+    return (size + KLOG_ALIGNMENT - 1) & ~(KLOG_ALIGNMENT - 1);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "stdtypes.h"
+
+typedef enum {
+    KLOG_ERROR      = 1,
+    KLOG_WARNING    = 2,
+    KLOG_INFO       = 3,
+    KLOG_DEBUG      = 4,
+} KLogLevel;
+
+void klog(KLogLevel level, const char* fmt, ...);
+void klogFlush();
+void klogDump();
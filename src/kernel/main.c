@@ -3,19 +3,41 @@
 #include "string.h"
 #include "hal/hal.h"
 #include "crashme.h"
+#include "initrd.h"
+#include "benchmark.h"
+#include "klog.h"
+#include "deferred.h"
 #include "arch/i686/irq.h"
+#include "arch/i686/cpu.h"
+#include "arch/i686/clock.h"
+#include "arch/i686/io.h"
+#include "arch/i686/apic.h"
 
-extern Uint8 __bss_start;
-extern Uint8 __bss_end;
+#define TIMER_TICKS_PER_LOG     18      // About once a second with the PIT at its default rate
 
-void timer(IRQRegisters* regs)
+/*
+ * Deferred by timer, so the formatting happens with interrupts enabled
+ */
+void timerLog(void* context)
 {
-    printf(".");
+    klog(KLOG_INFO, "timer: %u ticks", (Uint32) context);
 }
 
-void __attribute__((section(".entry"))) start(Uint16 bootDrive)
+/*
+ * Runs in interrupt context, so it leaves the logging to deferred work
+ */
+void timer(int irq)
 {
-    memset(&__bss_start, 0, (&__bss_end) - (&__bss_start));
+    static Uint32 ticks = 0;
+
+    if (++ticks % TIMER_TICKS_PER_LOG == 0) {
+        deferredQueue(timerLog, (void*) ticks);
+    }
+}
+
+void __attribute__((section(".entry"))) start(Uint16 bootDrive, void* initrdBase, Uint32 initrdSize)
+{
+    // No need to clear the bss. The stage2 ELF loader zero-fills it when it places the kernel
 
     halInitialize();
 
@@ -23,10 +45,45 @@ void __attribute__((section(".entry"))) start(Uint16 bootDrive)
 
     printf("Hello from the kernel!!\n");
 
+    cpuPrint();
+    printf("Clock: %llu Hz\n", clockGetFrequency());
+    apicPrint();
+
+    if (initrdBase != NULL && initrdInitialize(initrdBase, initrdSize)) {
+        initrdPrint();
+
+        const InitrdFile* hello = initrdFind("/hello.txt");
+        if (hello != NULL) {
+            for (Uint32 ii = 0; ii < hello->size; ++ii) {
+                putc(hello->data[ii]);
+            }
+        }
+    } else {
+        printf("No initrd\n");
+    }
+
+    //benchmarkMemory(cpuFeatures.sseEnabled && cpuFeatures.sse2);
+
     irqRegisterHandler(0, timer);
+
+    //benchmarkInterrupts();
     
     //crashMeInt64h();
     //crashMeDiv0();
     //crashMeInt6();
-    for (;;) ;
+
+    // Run the deferred work interrupts left behind and show what has been logged,
+    // then sleep until the next interrupt. Interrupts are off from the last check until the hlt
+    // so nothing can be queued in between and left waiting for the interrupt after
+    for (;;) {
+        deferredRun(DEFERRED_IRQ_BATCH);
+        klogFlush();
+
+        i686_disableInterrupts();
+        if (deferredPending()) {
+            i686_enableInterrupts();
+            continue;
+        }
+        i686_waitForInterrupt();
+    }
 }